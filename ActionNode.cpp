@@ -1,493 +1,157 @@
 #include "ActionNode.h"
-#include <cstring>
-#include <iostream>
-#include <cmath>
-using std::move;
-using std::make_unique;
-using std::memset;
-using std::pow;
+#include "RegretKernels.h"
+#include "ScratchArena.h"
+#include <algorithm>
 
-ActionNode::ActionNode(Node* parent, int player, int numHands)
+ActionNode::ActionNode(int player, int numHands)
 {
     this->numHands = numHands;
-    this->parent = parent;
     this->player = player;
 }
 
-void ActionNode::add_child(unique_ptr<Node> child, unique_ptr<Action> action)
+size_t ActionNode::get_block_size(StorageType storageType)
 {
-    numActions++;
-    children.push_back(move(child));
-    actions.push_back(move(action));
+    // round up to whole cache lines so every block starts 64 byte aligned
+    size_t elementSize = (storageType == StorageType::FLOAT32) ? sizeof(float) : sizeof(uint16_t);
+    size_t size = ((size_t)numHands * numActions * elementSize + 63) & ~(size_t)63;
+    return 64 + 2 * size;
 }
 
-int ActionNode::get_child_count()
+void ActionNode::set_storage(uint8_t* block, StorageType storageType)
 {
-    return children.size();
-}
+    this->storageType = storageType;
 
-Node* ActionNode::get_child(int index)
-{
-    return children.at(index).get();
+    header = (ActionNodeHeader*) block;
+    size_t size = (get_block_size(storageType) - 64) / 2;
+    regretSum = block + 64;
+    strategySum = block + 64 + size;
 }
 
-void ActionNode::initialize_strategySum()
+// Only called for 16-bit storage types, the values live in the frame.
+float* ActionNode::decode_block(uint8_t* block, int scaleIndex, ScratchFrame& frame)
 {
-    strategySum = vector<float>(numHands * numActions);
+    int size = numHands * numActions;
+    float* values = frame.allocate(size);
+    RegretKernels::decode(storageType, (const uint16_t*) block, header->scales[scaleIndex], values, size);
+    return values;
 }
 
-void ActionNode::initialize_regretSum()
+void ActionNode::encode_block(uint8_t* block, int scaleIndex, const float* values)
 {
-    regretSum = vector<float>(numHands * numActions);
+    header->scales[scaleIndex] = RegretKernels::encode(storageType, values, (uint16_t*) block, numHands * numActions);
 }
 
-vector<float> ActionNode::get_average_strategy()
+void ActionNode::get_average_strategy(float* averageStrategy)
 {
-	vector<float> averageStrategy = vector<float>(numHands*numActions);
+	// strategy sums are never negative, so regret matching just normalizes them
+	if (storageType == StorageType::FLOAT32)
+	{
+		RegretKernels::regret_matching((float*) strategySum, averageStrategy, numHands, numActions);
+		return;
+	}
 
-    for (int hand = 0; hand < numHands; hand++)
-    {
-        float total = 0;
-        
-        for (int action = 0; action < numActions; action++)
-            total += strategySum[hand + action*numHands];
-        
-        if (total > 0)
-            for (int action = 0; action < numActions; action++)
-                averageStrategy[hand + action*numHands] = strategySum[hand + action*numHands] / total;
-        else
-            for (int action = 0; action < numActions; action++)
-                averageStrategy[hand + action*numHands] = 1.0f / numActions;
-    }
-		
-	return averageStrategy;
+	ScratchFrame frame;
+	RegretKernels::regret_matching(decode_block(strategySum, 1, frame), averageStrategy, numHands, numActions);
 }
 
-vector<float> ActionNode::get_current_strategy()
+void ActionNode::get_current_strategy(float* strategy)
 {
-	switch (numActions)
+	if (storageType == StorageType::FLOAT32)
 	{
-		case 2:
-		{
-			vector<float> strategy = vector<float>(numHands * numActions);
-
-			float const * __restrict regretSum0 = &regretSum[0];
-			float const * __restrict regretSum1 = &regretSum[numHands];
-
-			float* __restrict strategy0 = &strategy[0];
-			float* __restrict strategy1 = &strategy[numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				if (regretSum0[hand] > 0.0f)
-				{
-					if (regretSum1[hand] > 0.0f)
-					{
-						float positiveRegretSum = regretSum0[hand] + regretSum1[hand];
-						strategy0[hand] = regretSum0[hand] / positiveRegretSum;
-						strategy1[hand] = regretSum1[hand] / positiveRegretSum;
-					}
-					else
-					{
-						strategy0[hand] = 1.0f;
-					}
-				}
-				else if (regretSum1[hand] > 0.0f)
-				{
-					strategy1[hand] = 1.0f;
-				}
-				else
-				{
-					strategy0[hand] = 0.5f;
-					strategy1[hand] = 0.5f;
-				}
-			}
-
-			return strategy;
-		}
-		case 3:
-		{
-			vector<float> strategy = vector<float>(numHands * numActions);
-
-			float const * __restrict regretSum0 = &regretSum[0];
-			float const * __restrict regretSum1 = &regretSum[numHands];
-			float const * __restrict regretSum2 = &regretSum[numHands + numHands];
-
-			float* __restrict strategy0 = &strategy[0];
-			float* __restrict strategy1 = &strategy[numHands];
-			float* __restrict strategy2 = &strategy[numHands + numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				if (regretSum0[hand] > 0.0f)
-				{
-					if (regretSum1[hand] > 0.0f)
-					{
-						if (regretSum2[hand] > 0.0f) //0, 1, 3
-						{
-							float positiveRegretSum = regretSum0[hand] + regretSum1[hand] + regretSum2[hand];
-							strategy0[hand] = regretSum0[hand] / positiveRegretSum;
-							strategy1[hand] = regretSum1[hand] / positiveRegretSum;
-							strategy2[hand] = regretSum2[hand] / positiveRegretSum;
-						}
-						else //0, 1
-						{
-							float positiveRegretSum = regretSum0[hand] + regretSum1[hand];
-							strategy0[hand] = regretSum0[hand] / positiveRegretSum;
-							strategy1[hand] = regretSum1[hand] / positiveRegretSum;
-						}
-					}
-					else if (regretSum2[hand] > 0.0f) //0, 2
-					{
-						float positiveRegretSum = regretSum0[hand] + regretSum2[hand];
-						strategy0[hand] = regretSum0[hand] / positiveRegretSum;
-						strategy2[hand] = regretSum2[hand] / positiveRegretSum;
-					}
-					else //0
-					{
-						strategy0[hand] = 1.0f;
-					}
-				}
-				else if (regretSum1[hand] > 0.0f)
-				{
-					if (regretSum2[hand] > 0.0f) //1, 2
-					{
-						float positiveRegretSum = regretSum1[hand] + regretSum2[hand];
-						strategy1[hand] = regretSum1[hand] / positiveRegretSum;
-						strategy2[hand] = regretSum2[hand] / positiveRegretSum;
-					}
-					else //1
-					{
-						strategy1[hand] = 1.0f;
-					}
-				}
-				else if (regretSum2[hand] > 0.0f) //0
-				{
-					strategy2[hand] = 1.0f;
-				}
-				else
-				{
-					strategy0[hand] = (1.0f / 3.0f);
-					strategy1[hand] = (1.0f / 3.0f);
-					strategy2[hand] = (1.0f / 3.0f);
-				}
-			}
-
-			return strategy;
-		}
-		case 4:
-		{
-			vector<float> strategy = vector<float>(numHands * numActions);
-
-			float const * __restrict regretSum0 = &regretSum[0];
-			float const * __restrict regretSum1 = &regretSum[numHands];
-			float const * __restrict regretSum2 = &regretSum[numHands + numHands];
-			float const * __restrict regretSum3 = &regretSum[numHands + numHands + numHands];
-
-			float* __restrict strategy0 = &strategy[0];
-			float* __restrict strategy1 = &strategy[numHands];
-			float* __restrict strategy2 = &strategy[numHands + numHands];
-			float* __restrict strategy3 = &strategy[numHands + numHands + numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				float positiveRegretSum = 0.0f;
-
-				if (regretSum0[hand] > 0.0f)
-					positiveRegretSum += regretSum0[hand];
-
-				if (regretSum1[hand] > 0.0f)
-					positiveRegretSum += regretSum1[hand];
-
-				if (regretSum2[hand] > 0.0f)
-					positiveRegretSum += regretSum2[hand];
-
-				if (regretSum3[hand] > 0.0f)
-					positiveRegretSum += regretSum3[hand];
-
-				if (positiveRegretSum > 0.0f)
-				{
-					if (regretSum0[hand] > 0.0f)
-						strategy0[hand] = regretSum0[hand] / positiveRegretSum;
+		RegretKernels::regret_matching((float*) regretSum, strategy, numHands, numActions);
+		return;
+	}
 
-					if (regretSum1[hand] > 0.0f)
-						strategy1[hand] = regretSum1[hand] / positiveRegretSum;
+	ScratchFrame frame;
+	RegretKernels::regret_matching(decode_block(regretSum, 0, frame), strategy, numHands, numActions);
+}
 
-					if (regretSum2[hand] > 0.0f)
-						strategy2[hand] = regretSum2[hand] / positiveRegretSum;
+int ActionNode::get_unplayed_actions(bool* unplayedActions)
+{
+	ScratchFrame frame;
+	const float* regrets = (storageType == StorageType::FLOAT32) ? (float*) regretSum : decode_block(regretSum, 0, frame);
+	int count = 0;
 
-					if (regretSum3[hand] > 0.0f)
-						strategy3[hand] = regretSum3[hand] / positiveRegretSum;
-				}
-				else
-				{
-					strategy0[hand] = 0.25f;
-					strategy1[hand] = 0.25f;
-					strategy2[hand] = 0.25f;
-					strategy3[hand] = 0.25f;
-				}
-			}
+	for (int action = 0; action < numActions; action++)
+	{
+		const float* row = regrets + action * numHands;
+		unplayedActions[action] = numHands > 0 && std::none_of(row, row + numHands, [](float regret) { return regret > 0; });
+		if (!unplayedActions[action])
+			continue;
 
-			return strategy;
-		}
-		default:
+		// hands without any positive regret play every action uniformly
+		for (int hand = 0; hand < numHands && unplayedActions[action]; hand++)
 		{
-			int size = numHands * numActions;
-			vector<float> strategy = vector<float>(size);
-			int index;
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				float positiveRegretSum = 0.0f;
-
-				for (index = hand; index < hand + size; index += numHands)
-					if (regretSum[index] > 0.0f)
-						positiveRegretSum += regretSum[index];
-
-				if (positiveRegretSum > 0.0f)
-				{
-					for (int index = hand; index < hand + size; index += numHands)
-						if (regretSum[index] > 0.0f)
-							strategy[index] = regretSum[index] / positiveRegretSum;
-				}
-				else
-				{
-					float uniformProbability = 1.0f / numActions;
-					for (int index = hand; index < hand + size; index += numHands)
-						strategy[index] = uniformProbability;
-				}
-			}
-			return strategy;
+			bool played = true;
+			for (int other = 0; other < numActions; other++)
+				if (regrets[other * numHands + hand] > 0)
+					played = false;
+			unplayedActions[action] = !played;
 		}
+		count += unplayedActions[action];
 	}
-}
 
-void ActionNode::update_regretSum_part_one(vector<float>& actionUtilities, int actionIndex)
-{
-	float* __restrict regretSumAction = &regretSum[actionIndex * numHands];
-	#pragma code_align 32
-	for (int hand = 0; hand < numHands; hand++)
-		regretSumAction[hand] += actionUtilities[hand];
+	return count;
 }
 
-void ActionNode::update_regretSum_part_two(vector<float>& utilities, int iterationCount)
+// 16-bit blocks are decoded into scratch buffers small enough to stay in
+// cache, updated there by the same kernels and encoded again.
+//
+// Regrets are only discounted when they are updated. A node that missed
+// iterations gets their discounts in one extra pass first; its current
+// strategy didn't need them, since regret matching ignores a common scale
+// of the positive regrets.
+void ActionNode::update_regretSum(const float* actionUtilities, float* utilities, int iterationCount, const bool* prunedActions)
 {
-	switch (numActions)
-	{
-		case 2:
-		{
-			float x = pow(iterationCount, 1.5f);
-			x = x / (x + 1);
+	const DcfrDiscount& discount = DcfrDiscount::get(iterationCount);
+	const int lastIteration = header->lastIteration;
+	header->lastIteration = iterationCount;
 
-			float* __restrict regretSum0 = &regretSum[0];
-			float* __restrict regretSum1 = &regretSum[numHands];
+	ScratchFrame frame;
+	float* regrets = (storageType == StorageType::FLOAT32) ? (float*) regretSum : decode_block(regretSum, 0, frame);
 
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				regretSum0[hand] -= utilities[hand];
-				if (regretSum0[hand] > 0.0f)
-					regretSum0[hand] *= x;
-				else if (regretSum0[hand] < 0.0f)
-					regretSum0[hand] *= 0.5f;
+	if (lastIteration < iterationCount - 1)
+		RegretKernels::discount_regrets(regrets, numHands * numActions, DcfrDiscount::get_skipped(lastIteration, iterationCount));
 
-				regretSum1[hand] -= utilities[hand];
-				if (regretSum1[hand] > 0.0f)
-					regretSum1[hand] *= x;
-				else if (regretSum1[hand] < 0.0f)
-					regretSum1[hand] *= 0.5f;
-			}
-		}
-		break;
-		case 3:
+	// pruned actions have no utilities, their regrets are only discounted
+	float** prunedRegrets = nullptr;
+	if (prunedActions)
+	{
+		prunedRegrets = frame.allocate_array<float*>(numActions);
+		for (int action = 0; action < numActions; action++)
 		{
-			float x = pow(iterationCount, 1.5f);
-			x = x / (x + 1);
-
-			float* __restrict regretSum0 = &regretSum[0];
-			float* __restrict regretSum1 = &regretSum[numHands];
-			float* __restrict regretSum2 = &regretSum[numHands + numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				regretSum0[hand] -= utilities[hand];
-				if (regretSum0[hand] > 0.0f)
-					regretSum0[hand] *= x;
-				else if (regretSum0[hand] < 0.0f)
-					regretSum0[hand] *= 0.5f;
-
-				regretSum1[hand] -= utilities[hand];
-				if (regretSum1[hand] > 0.0f)
-					regretSum1[hand] *= x;
-				else if (regretSum1[hand] < 0.0f)
-					regretSum1[hand] *= 0.5f;
-
-				regretSum2[hand] -= utilities[hand];
-				if (regretSum2[hand] > 0.0f)
-					regretSum2[hand] *= x;
-				else if (regretSum2[hand] < 0.0f)
-					regretSum2[hand] *= 0.5f;
-			}
+			if (!prunedActions[action])
+				continue;
+			prunedRegrets[action] = frame.allocate(numHands);
+			std::copy(regrets + action * numHands, regrets + (action + 1) * numHands, prunedRegrets[action]);
 		}
-		break;
-		case 4:
-		{
-			float x = pow(iterationCount, 1.5f);
-			x = x / (x + 1);
-
-			float* __restrict regretSum0 = &regretSum[0];
-			float* __restrict regretSum1 = &regretSum[numHands];
-			float* __restrict regretSum2 = &regretSum[numHands + numHands];
-			float* __restrict regretSum3 = &regretSum[numHands + numHands + numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				regretSum0[hand] -= utilities[hand];
-				if (regretSum0[hand] > 0.0f)
-					regretSum0[hand] *= x;
-				else if (regretSum0[hand] < 0.0f)
-					regretSum0[hand] *= 0.5f;
-
-				regretSum1[hand] -= utilities[hand];
-				if (regretSum1[hand] > 0.0f)
-					regretSum1[hand] *= x;
-				else if (regretSum1[hand] < 0.0f)
-					regretSum1[hand] *= 0.5f;
-
-				regretSum2[hand] -= utilities[hand];
-				if (regretSum2[hand] > 0.0f)
-					regretSum2[hand] *= x;
-				else if (regretSum2[hand] < 0.0f)
-					regretSum2[hand] *= 0.5f;
+	}
 
-				regretSum3[hand] -= utilities[hand];
-				if (regretSum3[hand] > 0.0f)
-					regretSum3[hand] *= x;
-				else if (regretSum3[hand] < 0.0f)
-					regretSum3[hand] *= 0.5f;
-			}
-		}
-		break;
-		default:
-		{
-			float x = pow(iterationCount, 1.5f);
-			x = x / (x + 1);
-			int index;
+	RegretKernels::update_hero_node(regrets, actionUtilities, utilities, numHands, numActions, discount);
 
-			for (int action = 0; action < numActions; action++)
-			{
-				index = action * numHands;
+	if (prunedActions)
+		for (int action = 0; action < numActions; action++)
+			if (prunedActions[action])
 				for (int hand = 0; hand < numHands; hand++)
-				{
-					regretSum[index] -= utilities[hand];
-					if (regretSum[index] > 0.0f)
-						regretSum[index] *= x;
-					else if (regretSum[index] < 0.0f)
-						regretSum[index] *= 0.5f;
-					index++;
-				}
-			}
-		}
-	}
+					regrets[action * numHands + hand] = prunedRegrets[action][hand] * discount.negativeRegret;
+
+	if (storageType != StorageType::FLOAT32)
+		encode_block(regretSum, 0, regrets);
 }
 
-void ActionNode::update_strategySum(vector<float>& strategy, vector<float>& reachProbs, int iterationCount)
+void ActionNode::update_strategySum(const float* reachProbs, float* actionReachProbs, int iterationCount)
 {
-	//if (iterationCount <= 50)
-	//	return;
+	const DcfrDiscount& discount = DcfrDiscount::get(iterationCount);
 
-	switch (numActions)
+	if (storageType == StorageType::FLOAT32)
 	{
-		case 2:
-		{
-			float x = pow(((float)iterationCount) / (iterationCount + 1), 2);
-
-			float* __restrict strategySum0 = &strategySum[0];
-			float* __restrict strategySum1 = &strategySum[numHands];
-
-			float* __restrict strategy0 = &strategy[0];
-			float* __restrict strategy1 = &strategy[numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				strategySum0[hand] += strategy0[hand] * reachProbs[hand];
-				strategySum0[hand] *= x;
-
-				strategySum1[hand] += strategy1[hand] * reachProbs[hand];
-				strategySum1[hand] *= x;
-			}
-
-			break;
-		}
-		case 3:
-		{
-			float x = pow(((float)iterationCount) / (iterationCount + 1), 2);
-
-			float* __restrict strategySum0 = &strategySum[0];
-			float* __restrict strategySum1 = &strategySum[numHands];
-			float* __restrict strategySum2 = &strategySum[numHands + numHands];
-
-			float* __restrict strategy0 = &strategy[0];
-			float* __restrict strategy1 = &strategy[numHands];
-			float* __restrict strategy2 = &strategy[numHands + numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				strategySum0[hand] += strategy0[hand] * reachProbs[hand];
-				strategySum0[hand] *= x;
-
-				strategySum1[hand] += strategy1[hand] * reachProbs[hand];
-				strategySum1[hand] *= x;
-
-				strategySum2[hand] += strategy2[hand] * reachProbs[hand];
-				strategySum2[hand] *= x;
-			}
-
-			break;
-		}
-		case 4:
-		{
-			float x = pow(((float)iterationCount) / (iterationCount + 1), 2);
-
-			float* __restrict strategySum0 = &strategySum[0];
-			float* __restrict strategySum1 = &strategySum[numHands];
-			float* __restrict strategySum2 = &strategySum[numHands + numHands];
-			float* __restrict strategySum3 = &strategySum[numHands + numHands + numHands];
-
-			float* __restrict strategy0 = &strategy[0];
-			float* __restrict strategy1 = &strategy[numHands];
-			float* __restrict strategy2 = &strategy[numHands + numHands];
-			float* __restrict strategy3 = &strategy[numHands + numHands + numHands];
-
-			for (int hand = 0; hand < numHands; hand++)
-			{
-				strategySum0[hand] += strategy0[hand] * reachProbs[hand];
-				strategySum0[hand] *= x;
-
-				strategySum1[hand] += strategy1[hand] * reachProbs[hand];
-				strategySum1[hand] *= x;
-
-				strategySum2[hand] += strategy2[hand] * reachProbs[hand];
-				strategySum2[hand] *= x;
-
-				strategySum3[hand] += strategy3[hand] * reachProbs[hand];
-				strategySum3[hand] *= x;
-			}
-
-			break;
-		}
-		default:
-		{
-			float x = pow(((float)iterationCount) / (iterationCount + 1), 2);
-
-			for (int action = 0; action < numActions; action++)
-			{
-				int index = action * numHands;
-				for (int hand = 0; hand < numHands; hand++)
-				{
-					strategySum[index] += strategy[index] * reachProbs[hand];
-					strategySum[index++] *= x;
-				}
-			}
-		}
+		RegretKernels::update_villain_node((float*) regretSum, (float*) strategySum, reachProbs, actionReachProbs, numHands, numActions, discount);
+		return;
 	}
-}
\ No newline at end of file
+
+	ScratchFrame frame;
+	float* regrets = decode_block(regretSum, 0, frame);
+	float* strategySums = decode_block(strategySum, 1, frame);
+	RegretKernels::update_villain_node(regrets, strategySums, reachProbs, actionReachProbs, numHands, numActions, discount);
+	encode_block(strategySum, 1, strategySums);
+}
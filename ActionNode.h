@@ -2,36 +2,82 @@
 #define ACTION_NODE_H
 
 #include "Node.h"
-#include "Action.h"
-#include <vector>
-#include <memory>
-using std::unique_ptr;
-using std::vector;
+#include "StorageTypeEnum.h"
+#include <cstddef>
+#include <stdint.h>
+
+class ScratchFrame;
+
+// The cache line in front of a node's regretSum and strategySum blocks
+struct ActionNodeHeader
+{
+    // regretSum and strategySum scale for FLOAT16 and INT16
+    float scales[2];
+
+    // last iteration regretSum was discounted for, nodes the traversal
+    // skips catch up on their next update
+    int32_t lastIteration;
+};
 
 class ActionNode : public Node
 {
     private:
-        vector<float> strategySum;
-        vector<float> regretSum;
+        // numHands*numActions values each, stored as storageType
+        uint8_t* regretSum = nullptr;
+        uint8_t* strategySum = nullptr;
+
+        ActionNodeHeader* header = nullptr;
+        StorageType storageType = StorageType::FLOAT32;
+
+        float* decode_block(uint8_t* block, int scaleIndex, ScratchFrame& frame);
+        void encode_block(uint8_t* block, int scaleIndex, const float* values);
 
     public:
         int numHands = 0;
         int numActions = 0;
-
-        vector<unique_ptr<Action>> actions;
-        vector<unique_ptr<Node>> children;
         int player;
-        ActionNode(Node* parent, int player, int numHands);
-        void add_child(unique_ptr<Node> child, unique_ptr<Action> action);
-        void initialize_strategySum();
-        void initialize_regretSum();
-		vector<float> get_average_strategy();
-        int get_child_count();
-        Node* get_child(int index);
-		vector<float> get_current_strategy();
-        void update_regretSum_part_one(vector<float>& actionUtilities, int actionIndex);
-        void update_regretSum_part_two(vector<float>& utilities, int iterationCount);
-        void update_strategySum(vector<float>& strategy, vector<float>& reachProbs, int iterationCount);
+
+        // Index of the first outgoing edge in GameTree::actions/children. The
+        // edges of a node are contiguous, one per action, and shared with the
+        // node's copies for the other cards of a chance node.
+        int firstChild = 0;
+
+        // Added to the ACTION and CHANCE edges to get this copy's children,
+        // 0 in the subtree the edges were built for
+        int actionNodeOffset = 0;
+        int chanceNodeOffset = 0;
+
+        // Byte offset of this node's blocks in GameTree::storage
+        size_t storageOffset = 0;
+
+        ActionNode(int player, int numHands);
+
+        // Bytes of storage the node needs: a cache line with the header,
+        // then the regretSum and strategySum blocks, each rounded up to a
+        // whole cache line.
+        size_t get_block_size(StorageType storageType);
+        void set_storage(uint8_t* block, StorageType storageType);
+
+        // strategies are written to caller provided buffers of numHands*numActions
+		void get_average_strategy(float* averageStrategy);
+		void get_current_strategy(float* strategy);
+
+        // Marks the actions the current strategy plays with probability 0
+        // for every hand and returns their count. Most actions have a hand
+        // with positive regret early in their block, so this rarely reads
+        // more than a few cache lines per action.
+        int get_unplayed_actions(bool* unplayedActions);
+
+        // Hero side: given the utility of every action, writes the node's
+        // utility under the current strategy and updates regretSum. Actions
+        // marked in prunedActions must have a current strategy of 0 for
+        // every hand and zeroed actionUtilities; their (negative) regrets
+        // are only discounted.
+        void update_regretSum(const float* actionUtilities, float* utilities, int iterationCount, const bool* prunedActions = nullptr);
+
+        // Villain side: writes the reach probs of every action under the
+        // current strategy and adds them to strategySum.
+        void update_strategySum(const float* reachProbs, float* actionReachProbs, int iterationCount);
 };
 
-#endif
\ No newline at end of file
+#endif
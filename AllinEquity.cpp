@@ -0,0 +1,154 @@
+#include "AllinEquity.h"
+#include "RangeManager.h"
+#include "card_utility.h"
+#include <algorithm>
+using std::fill;
+
+AllinEquity::AllinEquity(RangeManager& rangeManager, uint8_t board[5])
+{
+	int boardIndex = RangeManager::get_board_index(board);
+	numP1Hands = rangeManager.get_num_hands(1, boardIndex);
+	numP2Hands = rangeManager.get_num_hands(2, boardIndex);
+
+	vector<int> counts(numP1Hands * numP2Hands, 0);
+
+	uint8_t runoutBoard[5] = { board[0], board[1], board[2], board[3], board[4] };
+
+	if (board_has_turn(board))
+	{
+		runoutCount = 44;
+
+		for (uint8_t river = 0; river < 52; river++)
+		{
+			if (overlap(river, board))
+				continue;
+
+			runoutBoard[4] = river;
+			int riverIndex = RangeManager::get_board_index(runoutBoard);
+			add_runout(rangeManager, riverIndex, rangeManager.get_reach_probs_mapping(1, riverIndex),
+				rangeManager.get_reach_probs_mapping(2, riverIndex), counts);
+		}
+	}
+	else
+	{
+		runoutCount = 990;
+
+		vector<int> p1Mapping;
+		vector<int> p2Mapping;
+
+		for (uint8_t turn = 0; turn < 52; turn++)
+		{
+			if (overlap(turn, board))
+				continue;
+
+			runoutBoard[3] = turn;
+			runoutBoard[4] = 52;
+			int turnIndex = RangeManager::get_board_index(runoutBoard);
+			int* p1TurnMapping = rangeManager.get_reach_probs_mapping(1, turnIndex);
+			int* p2TurnMapping = rangeManager.get_reach_probs_mapping(2, turnIndex);
+
+			for (uint8_t river = turn + 1; river < 52; river++)
+			{
+				if (overlap(river, board))
+					continue;
+
+				// river hands map onto turn hands, which map onto flop hands
+				runoutBoard[4] = river;
+				int riverIndex = RangeManager::get_board_index(runoutBoard);
+				int* p1RiverMapping = rangeManager.get_reach_probs_mapping(1, riverIndex);
+				int* p2RiverMapping = rangeManager.get_reach_probs_mapping(2, riverIndex);
+
+				p1Mapping.resize(rangeManager.get_num_hands(1, riverIndex));
+				for (size_t i = 0; i < p1Mapping.size(); i++)
+					p1Mapping[i] = p1TurnMapping[p1RiverMapping[i]];
+
+				p2Mapping.resize(rangeManager.get_num_hands(2, riverIndex));
+				for (size_t i = 0; i < p2Mapping.size(); i++)
+					p2Mapping[i] = p2TurnMapping[p2RiverMapping[i]];
+
+				add_runout(rangeManager, riverIndex, p1Mapping.data(), p2Mapping.data(), counts);
+			}
+		}
+	}
+
+	// pairs that share a card can never meet at showdown
+	Hand* p1Hands = rangeManager.get_hands(1, boardIndex);
+	Hand* p2Hands = rangeManager.get_hands(2, boardIndex);
+	for (int i = 0; i < numP1Hands; i++)
+		for (int j = 0; j < numP2Hands; j++)
+			if (overlap(p1Hands[i], p2Hands[j]))
+				counts[i * numP2Hands + j] = 0;
+
+	if (runoutCount == 44)
+		turnCounts.assign(begin(counts), end(counts));
+	else
+		flopCounts.assign(begin(counts), end(counts));
+}
+
+void AllinEquity::add_runout(RangeManager& rangeManager, int boardIndex, const int* p1Mapping, const int* p2Mapping, vector<int>& counts)
+{
+	Hand* p1Hands = rangeManager.get_hands(1, boardIndex);
+	Hand* p2Hands = rangeManager.get_hands(2, boardIndex);
+	int numP1RiverHands = rangeManager.get_num_hands(1, boardIndex);
+	int numP2RiverHands = rangeManager.get_num_hands(2, boardIndex);
+
+	for (int i = 0; i < numP1RiverHands; i++)
+	{
+		int* row = &counts[p1Mapping[i] * numP2Hands];
+		int rank = p1Hands[i].rank;
+
+		for (int j = 0; j < numP2RiverHands; j++)
+			row[p2Mapping[j]] += (rank > p2Hands[j].rank) - (rank < p2Hands[j].rank);
+	}
+}
+
+void AllinEquity::get_utilities(int hero, float value, const float* villainReachProbs, float* utilities)
+{
+	float scale = value / runoutCount;
+
+	if (runoutCount == 44)
+		get_utilities(turnCounts.data(), hero, scale, villainReachProbs, utilities);
+	else
+		get_utilities(flopCounts.data(), hero, scale, villainReachProbs, utilities);
+}
+
+template <typename T>
+void AllinEquity::get_utilities(const T* counts, int hero, float scale, const float* villainReachProbs, float* utilities)
+{
+	if (hero == 1)
+	{
+		for (int i = 0; i < numP1Hands; i++)
+		{
+			const T* row = counts + i * numP2Hands;
+
+			// independent partial sums so the dot product vectorizes
+			float sums[16] = {};
+			int j = 0;
+			for (; j + 16 <= numP2Hands; j += 16)
+				for (int k = 0; k < 16; k++)
+					sums[k] += row[j + k] * villainReachProbs[j + k];
+
+			float sum = 0;
+			for (int k = 0; k < 16; k++)
+				sum += sums[k];
+			for (; j < numP2Hands; j++)
+				sum += row[j] * villainReachProbs[j];
+
+			utilities[i] = sum * scale;
+		}
+	}
+	else
+	{
+		// p2's results are the negated transpose, accumulated row by row
+		fill(utilities, utilities + numP2Hands, 0.0f);
+		for (int i = 0; i < numP1Hands; i++)
+		{
+			const T* row = counts + i * numP2Hands;
+			float reach = villainReachProbs[i] * -scale;
+			if (reach == 0)
+				continue;
+			for (int j = 0; j < numP2Hands; j++)
+				utilities[j] += row[j] * reach;
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef ALLIN_EQUITY_H
+#define ALLIN_EQUITY_H
+
+#include <stdint.h>
+#include <vector>
+using std::vector;
+
+class RangeManager;
+
+// Showdown results of every p1 hand against every p2 hand over all runouts
+// of a flop or turn board. Entry [i][j] is the number of runouts p1 hand i
+// wins minus the number it loses against p2 hand j, counting only runouts
+// that don't collide with either hand, and 0 when the two hands share a
+// card. The runout distribution never changes, so an all-in terminal
+// becomes one matrix-vector product instead of a showdown per runout.
+//
+// Hands are indexed like RangeManager::get_hands(player, boardIndex). A turn
+// board has at most 44 runouts, so its counts fit in int8; a flop board has
+// 990 and uses int16.
+class AllinEquity
+{
+    private:
+        int numP1Hands;
+        int numP2Hands;
+        int runoutCount;
+
+        vector<int8_t> turnCounts;
+        vector<int16_t> flopCounts;
+
+        void add_runout(RangeManager& rangeManager, int boardIndex, const int* p1Mapping, const int* p2Mapping, vector<int>& counts);
+
+        template <typename T>
+        void get_utilities(const T* counts, int hero, float scale, const float* villainReachProbs, float* utilities);
+
+    public:
+        AllinEquity(RangeManager& rangeManager, uint8_t board[5]);
+
+        // utilities of every hero hand for a pot of 2 * value
+        void get_utilities(int hero, float value, const float* villainReachProbs, float* utilities);
+};
+
+#endif
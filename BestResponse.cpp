@@ -11,57 +11,55 @@
 
 using std::cout;
 
-BestResponse::BestResponse(std::shared_ptr<RangeManager> rangeManager, Node* root,
+BestResponse::BestResponse(std::shared_ptr<RangeManager> rangeManager, GameTree* tree,
                            uint8_t initialBoard[5], int initialPot, int inPositionPlayer)
 {
     this->rangeManager = rangeManager;
-    this->root = root;
+    this->tree = tree;
     for (int i = 0; i < 5; i++) this->initialBoard[i] = initialBoard[i];
     this->initialPot = initialPot;
     this->inPositionPlayer = inPositionPlayer;
     set_relative_probabilities(initialBoard);
+
+    p1InitialReachProbs = rangeManager->get_initial_reach_probs(1);
+    p2InitialReachProbs = rangeManager->get_initial_reach_probs(2);
+    p1Result.resize(rangeManager->get_starting_hands(1).size());
+    p2Result.resize(rangeManager->get_starting_hands(2).size());
 }
 
-float BestResponse::get_best_response_Ev(int hero, int villain)
+void BestResponse::get_best_response_Evs(float& p1Ev, float& p2Ev)
 {
-    float totalEv = 0.0f;
-
-    std::vector<Hand>& heroHands    = rangeManager->get_starting_hands(hero);
-    std::vector<Hand>& villainHands = rangeManager->get_starting_hands(villain);
-
-    std::vector<float>& relativeProbs = (hero == 1) ? p1RelativeProbs : p2RelativeProbs;
-    std::vector<float> villainReachProbs = rangeManager->get_initial_reach_probs(villain);
+    float* results[2] = { p1Result.data(), p2Result.data() };
+    const float* reachProbs[2] = { p1InitialReachProbs.data(), p2InitialReachProbs.data() };
 
-    std::vector<float> result;
     // modern oneTBB kickoff
     tbb::task_group tg;
-    BestResponseTask br(rangeManager, &result, root, hero, villain, &villainReachProbs, initialBoard);
+    BestResponseTask br(rangeManager, results, tree, tree->root, reachProbs, initialBoard,
+                        RangeManager::get_board_index(initialBoard), strategySnapshot);
     tg.run([&]{ br.run(); });
     tg.wait();
 
-    std::vector<float>& evs = result;
-    for (int i = 0; i < static_cast<int>(heroHands.size()); i++) {
-        totalEv += evs[i] / get_unblocked_combo_count(heroHands[i], villainHands) * relativeProbs[i];
-    }
-    return totalEv;
-}
+    for (int hero = 1; hero <= 2; hero++) {
+        std::vector<float>& evs = (hero == 1) ? p1Result : p2Result;
+        std::vector<float>& relativeProbs = (hero == 1) ? p1RelativeProbs : p2RelativeProbs;
+        std::vector<float>& unblockedComboCounts = (hero == 1) ? p1UnblockedComboCounts : p2UnblockedComboCounts;
 
-float BestResponse::get_unblocked_combo_count(Hand& heroHand, std::vector<Hand>& villainHands)
-{
-    float sum = 0.0f;
-    for (int i = 0; i < static_cast<int>(villainHands.size()); i++)
-        if (!overlap(villainHands[i], heroHand))
-            sum += villainHands[i].probability;
-    return sum;
+        float totalEv = 0.0f;
+        for (int i = 0; i < static_cast<int>(evs.size()); i++)
+            totalEv += evs[i] / unblockedComboCounts[i] * relativeProbs[i];
+        (hero == 1 ? p1Ev : p2Ev) = totalEv;
+    }
 }
 
 void BestResponse::set_relative_probabilities(uint8_t initialBoard[5])
 {
     for (int player = 1; player <= 2; player++) {
         std::vector<float>& relativeProbs = (player == 1) ? p1RelativeProbs : p2RelativeProbs;
+        std::vector<float>& unblockedComboCounts = (player == 1) ? p1UnblockedComboCounts : p2UnblockedComboCounts;
         std::vector<Hand>& heroStartingHands    = rangeManager->get_starting_hands(player);
         std::vector<Hand>& villainStartingHands = rangeManager->get_starting_hands(player ^ 1 ^ 2);
         relativeProbs.resize(heroStartingHands.size());
+        unblockedComboCounts.resize(heroStartingHands.size());
 
         float relativeSum = 0.0f;
 
@@ -75,6 +73,7 @@ void BestResponse::set_relative_probabilities(uint8_t initialBoard[5])
                 villainSum += villainHand.probability;
             }
 
+            unblockedComboCounts[i] = villainSum;
             relativeProbs[i] = villainSum * heroHand.probability;
             relativeSum += relativeProbs[i];
         }
@@ -84,22 +83,24 @@ void BestResponse::set_relative_probabilities(uint8_t initialBoard[5])
     }
 }
 
-void BestResponse::print_exploitability()
+float BestResponse::get_exploitability()
 {
-    float oopEv = 0.0f;
-    float ipEv  = 0.0f;
-
-    if (inPositionPlayer == 1) {
-        ipEv  = get_best_response_Ev(1, 2);
-        oopEv = get_best_response_Ev(2, 1);
-    } else {
-        ipEv  = get_best_response_Ev(2, 1);
-        oopEv = get_best_response_Ev(1, 2);
-    }
+    float p1Ev, p2Ev;
+    get_best_response_Evs(p1Ev, p2Ev);
+    return (p1Ev + p2Ev) / 2 / initialPot * 100.0f;
+}
+
+float BestResponse::print_exploitability()
+{
+    float p1Ev, p2Ev;
+    get_best_response_Evs(p1Ev, p2Ev);
+    float oopEv = (inPositionPlayer == 1) ? p2Ev : p1Ev;
+    float ipEv  = (inPositionPlayer == 1) ? p1Ev : p2Ev;
 
     float exploitability = (oopEv + ipEv) / 2 / initialPot * 100.0f;
 
     cout << "OOP BR EV: " << oopEv << "\n";
     cout << "IP BR EV: " << ipEv << "\n";
     cout << "Exploitability: " << exploitability << "%%\n";
+    return exploitability;
 }
@@ -3,10 +3,8 @@
 
 #include <memory>
 #include "RangeManager.h"
-#include "Node.h"
-#include "ActionNode.h"
-#include "ChanceNode.h"
-#include "TerminalNode.h"
+#include "GameTree.h"
+#include "StrategySnapshot.h"
 #include <stdint.h>
 #include <vector>
 using std::vector;
@@ -19,17 +17,32 @@ class BestResponse
         shared_ptr<RangeManager> rangeManager;
 		vector<float> p1RelativeProbs;
 		vector<float> p2RelativeProbs;
+		vector<float> p1InitialReachProbs;
+		vector<float> p2InitialReachProbs;
+		vector<float> p1Result;
+		vector<float> p2Result;
+
+		// villain combos each starting hand doesn't block, summed up by
+		// set_relative_probabilities
+		vector<float> p1UnblockedComboCounts;
+		vector<float> p2UnblockedComboCounts;
 
     public:
-		Node* root;
+		GameTree* tree;
 		uint8_t initialBoard[5];
 		int initialPot;
 		int inPositionPlayer;
 
-        BestResponse(shared_ptr<RangeManager> rangeManager, Node* root, uint8_t initialBoard[5], int initialPot, int inPositionPlayer);
-        float get_best_response_Ev(int hero, int villain);
-        void print_exploitability();
-		float get_unblocked_combo_count(Hand& heroHand, vector<Hand>& villainHands);
+		// when set, players play these strategies instead of the tree's
+		const StrategySnapshot* strategySnapshot = nullptr;
+
+        BestResponse(shared_ptr<RangeManager> rangeManager, GameTree* tree, uint8_t initialBoard[5], int initialPot, int inPositionPlayer);
+        // best response EVs of both players, from one traversal
+        void get_best_response_Evs(float& p1Ev, float& p2Ev);
+        // prints both best response EVs and returns the exploitability in
+        // percent of the initial pot
+        float print_exploitability();
+        float get_exploitability();
 		void set_relative_probabilities(uint8_t initialBoard[5]);
 };
 
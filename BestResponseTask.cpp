@@ -1,221 +1,250 @@
 #include "BestResponseTask.h"
 #include "card_utility.h"
+#include "ScratchArena.h"
 
-#include <typeinfo>
+#include <algorithm>
 #include <cstring>
 #include <limits>
 #include <vector>
 #include <memory>
-#include <utility>
 
 #include "ChanceNodeTypeEnum.h"
 #include "Hand.h"
 #include "TerminalNodeTypeEnum.h"
-#include "NodeTypeEnum.h"
 
-#include <tbb/task_group.h>
 
 using std::vector;
-using std::unique_ptr;
 using std::shared_ptr;
-using std::pair;
+using std::fill;
 using std::memset;
 
 BestResponseTask::BestResponseTask(shared_ptr<RangeManager> rangeManager,
-                                   vector<float>* result,
-                                   Node* node,
-                                   int hero,
-                                   int villain,
-                                   vector<float>* villainReachProbs,
-                                   uint8_t board[5])
+                                   float* const results[2],
+                                   GameTree* tree,
+                                   NodeRef node,
+                                   const float* const reachProbs[2],
+                                   uint8_t board[5],
+                                   int boardIndex,
+                                   const StrategySnapshot* strategySnapshot)
 {
     this->rangeManager = rangeManager;
-    this->result = result;
+    this->tree = tree;
     this->node = node;
-    this->hero = hero;
-    this->villain = villain;
-    this->villainReachProbs = villainReachProbs;
+    for (int player = 0; player < 2; player++) {
+        this->results[player] = results[player];
+        this->reachProbs[player] = reachProbs[player];
+    }
     for (int i = 0; i < 5; i++)
         this->board[i] = board[i];
+    this->boardIndex = boardIndex;
+    this->strategySnapshot = strategySnapshot;
 }
 
-void BestResponseTask::run() {
-    // Terminal node
-    if (typeid(*node) == typeid(TerminalNode)) {
-        *result = terminal_node_best_response(static_cast<TerminalNode*>(node),
-                                              hero, villain, *villainReachProbs, board);
-        return;
+// Terminal EVs of each player whose villain still has reach, 0 otherwise
+template <typename Evaluate>
+void BestResponseTask::terminal_best_response(const Evaluate& evaluate)
+{
+    for (int hero = 1; hero <= 2; hero++) {
+        const int villain = hero ^ 1 ^ 2;
+        if (reachProbs[villain - 1])
+            evaluate(hero, villain, reachProbs[villain - 1], results[hero - 1]);
+        else
+            fill(results[hero - 1], results[hero - 1] + rangeManager->get_num_hands(hero, boardIndex), 0.0f);
     }
+}
 
-    // Chance node
-    if (typeid(*node) == typeid(ChanceNode)) {
-        *result = chance_node_best_response(static_cast<ChanceNode*>(node),
-                                            hero, villain, *villainReachProbs, board);
-        return;
+template <>
+void BestResponseTask::visit<NodeKind::ALLIN>(TerminalNode& node)
+{
+    terminal_best_response([&](int hero, int villain, const float* villainReachProbs, float* evs) {
+        allin_best_response(&node, hero, villain, villainReachProbs, boardIndex, evs);
+    });
+}
+
+template <>
+void BestResponseTask::visit<NodeKind::UNCONTESTED>(TerminalNode& node)
+{
+    terminal_best_response([&](int hero, int villain, const float* villainReachProbs, float* evs) {
+        uncontested_best_response(&node, hero, villain, villainReachProbs, boardIndex, evs);
+    });
+}
+
+template <>
+void BestResponseTask::visit<NodeKind::SHOWDOWN>(TerminalNode& node)
+{
+    terminal_best_response([&](int hero, int villain, const float* villainReachProbs, float* evs) {
+        showdown_best_response(&node, hero, villain, villainReachProbs, boardIndex, evs);
+    });
+}
+
+template <>
+void BestResponseTask::visit<NodeKind::CHANCE>(ChanceNode& node)
+{
+    chance_node_best_response(&node);
+}
+
+template <>
+void BestResponseTask::visit<NodeKind::ACTION>(ActionNode& node)
+{
+    ActionNode* actionNode = &node;
+    const int numActions = actionNode->numActions;
+
+    // the acting player and the other one
+    const int p = actionNode->player - 1;
+    const int q = 1 - p;
+    const int numHands[2] = { rangeManager->get_num_hands(1, boardIndex), rangeManager->get_num_hands(2, boardIndex) };
+
+    ScratchFrame frame;
+    float* actionResults[2] = { frame.allocate(numActions * numHands[0]), frame.allocate(numActions * numHands[1]) };
+
+    // Per-action reach probs of the acting player under its average
+    // strategy. One traversal visits every node once, so the strategy is
+    // normalized once per evaluation, or read from a snapshot. The other
+    // player's reach passes through unchanged.
+    const float** actionReachProbs = frame.allocate_array<const float*>(numActions);
+    const float* strategy = nullptr;
+    if (reachProbs[p] && strategySnapshot) {
+        strategy = strategySnapshot->get_strategy(this->node.index);
+    } else if (reachProbs[p]) {
+        float* averageStrategy = frame.allocate(numActions * numHands[p]);
+        actionNode->get_average_strategy(averageStrategy);
+        strategy = averageStrategy;
     }
 
-    // Action node
-    ActionNode* actionNode = static_cast<ActionNode*>(node);
-    const int numHeroHands    = rangeManager->get_num_hands(hero,    board);
-    const int numVillainHands = rangeManager->get_num_hands(villain, board);
-    const int numActions      = actionNode->numActions;
-
-    if (hero == actionNode->player) {
-        // Hero to act: take element-wise max across child EVs
-        *result = vector<float>(numHeroHands, -std::numeric_limits<float>::max());
-        vector<vector<float>> results(numActions);
-
-        tbb::task_group tg;
-        for (int action = 0; action < numActions; ++action) {
-            Node* childNode = actionNode->get_child(action);
-            tg.run([this, childNode, action, &results] {
-                BestResponseTask sub(rangeManager, &results[action],
-                                     childNode, hero, villain, villainReachProbs, board);
-                sub.run();
-            });
-        }
-        tg.wait();
-
-        vector<float>& maxSubgameEvs = *result;
-        for (int action = 0; action < numActions; ++action) {
-            vector<float>& subgameEvs = results[action];
-            for (int hand = 0; hand < numHeroHands; ++hand) {
-                if (subgameEvs[hand] > maxSubgameEvs[hand]) {
-                    maxSubgameEvs[hand] = subgameEvs[hand];
-                }
-            }
-        }
-    } else {
-        // Villain to act: expectation over villain strategy
-        vector<float> avgStrategy = actionNode->get_average_strategy();
-
-        *result = vector<float>(numHeroHands, 0.0f);
-        vector<vector<float>> results(numActions);
-        vector<vector<float>> newVillainReachProbss(numActions);
-        for (int a = 0; a < numActions; ++a) {
-            newVillainReachProbss[a].resize(numVillainHands);
-        }
+    for (int action = 0; action < numActions; ++action) {
+        actionReachProbs[action] = nullptr;
+        if (!reachProbs[p])
+            continue;
+
+        float* actionReach = frame.allocate(numHands[p]);
+        const float* actionStrategy = strategy + action * numHands[p];
+        for (int hand = 0; hand < numHands[p]; ++hand)
+            actionReach[hand] = actionStrategy[hand] * reachProbs[p][hand];
+        if (has_reach(actionReach, numHands[p]))
+            actionReachProbs[action] = actionReach;
+    }
 
-        // Per-action villain reach probs
-        for (int action = 0; action < numActions; ++action) {
-            vector<float>& newVRP = newVillainReachProbss[action];
-            int index = action * numVillainHands;
-            for (int hand = 0; hand < numVillainHands; ++hand) {
-                newVRP[hand] = avgStrategy[index++] * (*villainReachProbs)[hand];
-            }
-        }
+    for_each_child(tree, node, numActions, [&](int action) {
+        float* childResults[2] = { actionResults[0] + action * numHands[0], actionResults[1] + action * numHands[1] };
+        const float* childReachProbs[2];
+        childReachProbs[p] = actionReachProbs[action];
+        childReachProbs[q] = reachProbs[q];
 
-        tbb::task_group tg;
-        for (int action = 0; action < numActions; ++action) {
-            Node* childNode = actionNode->get_child(action);
-            tg.run([this, childNode, action, &results, &newVillainReachProbss] {
-                BestResponseTask sub(rangeManager, &results[action],
-                                     childNode, hero, villain,
-                                     &newVillainReachProbss[action], board);
-                sub.run();
-            });
+        if (!childReachProbs[0] && !childReachProbs[1]) {
+            fill(childResults[0], childResults[0] + numHands[0], 0.0f);
+            fill(childResults[1], childResults[1] + numHands[1], 0.0f);
+            return;
         }
-        tg.wait();
 
-        vector<float>& cumSubgameEvs = *result;
-        for (int action = 0; action < numActions; ++action) {
-            vector<float>& subgameEvs = results[action];
-            for (int hand = 0; hand < numHeroHands; ++hand) {
-                cumSubgameEvs[hand] += subgameEvs[hand];
+        BestResponseTask sub(rangeManager, childResults, tree, tree->get_child(*actionNode, action),
+                             childReachProbs, board, boardIndex, strategySnapshot);
+        sub.run();
+    });
+
+    // The acting player picks the best action for every hand
+    float* maxSubgameEvs = results[p];
+    fill(maxSubgameEvs, maxSubgameEvs + numHands[p], -std::numeric_limits<float>::max());
+    for (int action = 0; action < numActions; ++action) {
+        const float* subgameEvs = actionResults[p] + action * numHands[p];
+        for (int hand = 0; hand < numHands[p]; ++hand) {
+            if (subgameEvs[hand] > maxSubgameEvs[hand]) {
+                maxSubgameEvs[hand] = subgameEvs[hand];
             }
         }
     }
+
+    // The other player gets the expectation over the acting player's
+    // strategy, which is already in the reach the children got
+    float* cumSubgameEvs = results[q];
+    fill(cumSubgameEvs, cumSubgameEvs + numHands[q], 0.0f);
+    for (int action = 0; action < numActions; ++action) {
+        const float* subgameEvs = actionResults[q] + action * numHands[q];
+        for (int hand = 0; hand < numHands[q]; ++hand) {
+            cumSubgameEvs[hand] += subgameEvs[hand];
+        }
+    }
 }
 
-vector<float> BestResponseTask::chance_node_best_response(
-    ChanceNode* node, int hero, int villain,
-    vector<float>& villainReachProbs, uint8_t board[5])
+void BestResponseTask::run()
 {
-    vector<Hand>& heroHands = rangeManager->get_hands(hero, board);
-    vector<unique_ptr<ChanceNodeChild>>& children = node->get_children();
-    const int childCount = static_cast<int>(children.size());
+    dispatch(tree, node, *this);
+}
 
-    vector<vector<float>> results(childCount);
-    vector<vector<float>> newVillainReachProbss(childCount);
+void BestResponseTask::chance_node_best_response(ChanceNode* node)
+{
+    ChanceNodeChild* children = tree->get_children(*node);
+    const int childCount = node->childCount;
+
+    ScratchFrame frame;
+    float** childResults = frame.allocate_array<float*>(2 * childCount);
+    const float** childReachProbs = frame.allocate_array<const float*>(2 * childCount);
+    int* boardIndices = frame.allocate_array<int>(childCount);
 
-    // Precompute per-child villain reach probs
+    // Precompute per-child reach probs of both players
     for (int i = 0; i < childCount; ++i) {
         uint8_t nb[5];
         for (int j = 0; j < 5; ++j) nb[j] = board[j];
 
-        const uint8_t card = children[i]->card;
+        const uint8_t card = children[i].card;
         if (board[3] == 52) nb[3] = card; else nb[4] = card;
 
-        newVillainReachProbss[i] = rangeManager->get_reach_probs(villain, nb, villainReachProbs);
+        boardIndices[i] = RangeManager::get_board_index(nb);
+        for (int player = 1; player <= 2; ++player) {
+            const int numChildHands = rangeManager->get_num_hands(player, boardIndices[i]);
+            childResults[2 * i + player - 1] = frame.allocate(numChildHands);
+            childReachProbs[2 * i + player - 1] = nullptr;
+            if (!reachProbs[player - 1])
+                continue;
+
+            float* reach = frame.allocate(numChildHands);
+            rangeManager->get_reach_probs(player, boardIndices[i], reachProbs[player - 1], reach);
+            if (has_reach(reach, numChildHands))
+                childReachProbs[2 * i + player - 1] = reach;
+        }
     }
 
     // Spawn children in parallel
-    tbb::task_group tg;
-    for (int i = 0; i < childCount; ++i) {
-        Node* child = children[i]->node.get();
-        tg.run([this, i, child, &results, &newVillainReachProbss, &children] {
-            uint8_t nb[5];
-            for (int j = 0; j < 5; ++j) nb[j] = this->board[j];
-
-            const uint8_t card = children[i]->card;
-            if (this->board[3] == 52) nb[3] = card; else nb[4] = card;
-
-            BestResponseTask sub(this->rangeManager, &results[i],
-                                 child, this->hero, this->villain,
-                                 &newVillainReachProbss[i], nb);
-            sub.run();
-        });
-    }
-    tg.wait();
-
-    // Combine
-    vector<float> utilities(heroHands.size(), 0.0f);
+    for_each_child(tree, *node, childCount, [&](int i) {
+        if (!childReachProbs[2 * i] && !childReachProbs[2 * i + 1]) {
+            for (int player = 1; player <= 2; ++player)
+                fill(childResults[2 * i + player - 1], childResults[2 * i + player - 1] + rangeManager->get_num_hands(player, boardIndices[i]), 0.0f);
+            return;
+        }
 
-    uint8_t nb[5];
-    for (int j = 0; j < 5; ++j) nb[j] = board[j];
+        uint8_t nb[5];
+        for (int j = 0; j < 5; ++j) nb[j] = board[j];
 
-    for (int i = 0; i < childCount; ++i) {
-        const uint8_t card = children[i]->card;
+        const uint8_t card = children[i].card;
         if (board[3] == 52) nb[3] = card; else nb[4] = card;
 
-        vector<float>& subgameUtilities = results[i];
-        vector<int>& reachProbsMapping  = rangeManager->get_reach_probs_mapping(hero, nb);
-
-        for (int k = 0; k < static_cast<int>(subgameUtilities.size()); ++k)
-            utilities[reachProbsMapping[k]] += subgameUtilities[k];
-    }
-
-    const int weight = (board[3] == 52) ? 45 : 44;
-    for (int h = 0; h < static_cast<int>(utilities.size()); ++h) utilities[h] /= weight;
-
-    return utilities;
-}
+        BestResponseTask sub(rangeManager, childResults + 2 * i, tree, children[i].node,
+                             childReachProbs + 2 * i, nb, boardIndices[i], strategySnapshot);
+        sub.run();
+    });
 
-vector<float> BestResponseTask::terminal_node_best_response(TerminalNode* node,
-                                                            int hero, int villain,
-                                                            vector<float>& villainReachProbs,
-                                                            uint8_t board[5])
-{
-    if (node->type == TerminalNodeType::ALLIN)
-        return allin_best_response(node, hero, villain, villainReachProbs, board);
-    else if (node->type == TerminalNodeType::UNCONTESTED)
-        return uncontested_best_response(node, hero, villain, villainReachProbs, board);
-    else
-        return showdown_best_response(node, hero, villain, villainReachProbs, board);
+    // Combine
+    for (int player = 1; player <= 2; ++player)
+        combine_chance_results(tree, *rangeManager, *node, player, board, boardIndex, boardIndices,
+                               childResults + player - 1, 2, results[player - 1]);
 }
 
-vector<float> BestResponseTask::showdown_best_response(TerminalNode* node,
-                                                       int hero, int villain,
-                                                       vector<float>& villainReachProbs,
-                                                       uint8_t board[5])
+void BestResponseTask::showdown_best_response(TerminalNode* node,
+                                              int hero, int villain,
+                                              const float* villainReachProbs,
+                                              int boardIndex, float* evs)
 {
-    vector<Hand>& heroHands    = rangeManager->get_hands(hero, board);
-    vector<Hand>& villainHands = rangeManager->get_hands(villain, board);
+    Hand* heroHands          = rangeManager->get_hands(hero, boardIndex);
+    const Hand* villainHands = rangeManager->get_hands(villain, boardIndex);
 
-    int numHeroHands    = static_cast<int>(heroHands.size());
-    int numVillainHands = static_cast<int>(villainHands.size());
+    int numHeroHands    = rangeManager->get_num_hands(hero, boardIndex);
+    int numVillainHands = rangeManager->get_num_hands(villain, boardIndex);
 
-    vector<float> evs(numHeroHands, 0);
+    // the sweeps only visit villain hands with reach
+    ScratchFrame frame;
+    if (compact_reach(villainHands, villainReachProbs, numVillainHands, frame) == 0) {
+        fill(evs, evs + numHeroHands, 0.0f);
+        return;
+    }
 
     float value = node->value;
 
@@ -227,7 +256,7 @@ vector<float> BestResponseTask::showdown_best_response(TerminalNode* node,
 
     int j = 0;
     for (int i = 0; i < numHeroHands;) {
-        while (heroHands[i].rank > villainHands[j].rank) {
+        while (j < numVillainHands && heroHands[i].rank > villainHands[j].rank) {
             winSum += villainReachProbs[j];
 
             cardWinSum[villainHands[j].card1] += villainReachProbs[j];
@@ -249,7 +278,7 @@ vector<float> BestResponseTask::showdown_best_response(TerminalNode* node,
 
     j = numVillainHands - 1;
     for (int i = numHeroHands - 1; i >= 0;) {
-        while (heroHands[i].rank < villainHands[j].rank) {
+        while (j >= 0 && heroHands[i].rank < villainHands[j].rank) {
             loseSum += villainReachProbs[j];
 
             cardLoseSum[villainHands[j].card1] += villainReachProbs[j];
@@ -264,155 +293,19 @@ vector<float> BestResponseTask::showdown_best_response(TerminalNode* node,
                 - cardLoseSum[heroHands[k].card2]) * value;
         i = k;
     }
-
-    return evs;
 }
 
-vector<float> BestResponseTask::allin_best_response(
+void BestResponseTask::allin_best_response(
     TerminalNode* node, int hero, int villain,
-    vector<float>& villainReachProbs, uint8_t board[5])
+    const float* villainReachProbs, int boardIndex, float* evs)
 {
-    vector<Hand>& heroHands    = rangeManager->get_hands(hero, board);
-    (void)heroHands; // silence unused warning in some paths
-
-    vector<float> evs(heroHands.size(), 0.0f);
-
-    uint8_t nb[5];
-    for (int j = 0; j < 5; ++j) nb[j] = board[j];
-
-    if (board_has_turn(board)) {
-        // ---- river only (44 rivers) ----
-        vector<uint8_t> rivers;
-        rivers.reserve(44);
-        for (uint8_t r = 0; r < 52; ++r)
-            if (!overlap(r, board)) rivers.push_back(r);
-
-        vector<vector<float>> results(rivers.size());
-
-        tbb::task_group tg;
-        for (size_t idx = 0; idx < rivers.size(); ++idx) {
-            tg.run([this, idx, &results, node, &rivers] {
-                uint8_t nb_local[5];
-                for (int j = 0; j < 5; ++j) nb_local[j] = this->board[j];
-                nb_local[4] = rivers[idx];
-
-                vector<float> vrp = this->rangeManager->get_reach_probs(
-                    this->villain, nb_local, *this->villainReachProbs);
-
-                results[idx] = this->showdown_best_response(node, this->hero, this->villain,
-                                                            vrp, nb_local);
-            });
-        }
-        tg.wait();
-
-        for (size_t idx = 0; idx < rivers.size(); ++idx) {
-            nb[4] = rivers[idx];
-            vector<int>& rpm = rangeManager->get_reach_probs_mapping(hero, nb);
-            vector<float>& sub = results[idx];
-            for (int k = 0; k < static_cast<int>(sub.size()); ++k)
-                evs[rpm[k]] += sub[k];
-        }
-        for (int i = 0; i < static_cast<int>(evs.size()); ++i) evs[i] /= 44.0f;
-    } else {
-        // ---- turn + river pairs (49*48/2) ----
-        vector<std::pair<uint8_t,uint8_t>> pairs;
-        pairs.reserve(49 * 48 / 2);
-        for (uint8_t t = 0; t < 52; ++t) {
-            if (overlap(t, board)) continue;
-            for (uint8_t r = t + 1; r < 52; ++r) {
-                if (overlap(r, board)) continue;
-                pairs.emplace_back(t, r);
-            }
-        }
-
-        vector<vector<float>> results(pairs.size());
-
-        tbb::task_group tg;
-        for (size_t idx = 0; idx < pairs.size(); ++idx) {
-            tg.run([this, idx, &results, node, &pairs] {
-                const auto [t, r] = pairs[idx];
-
-                uint8_t nb_local[5];
-                for (int j = 0; j < 5; ++j) nb_local[j] = this->board[j];
-
-                nb_local[3] = t;
-                vector<float> vrp_turn = this->rangeManager->get_reach_probs(
-                    this->villain, nb_local, *this->villainReachProbs);
-
-                nb_local[4] = r;
-                vector<float> vrp_river = this->rangeManager->get_reach_probs(
-                    this->villain, nb_local, vrp_turn);
-
-                results[idx] = this->showdown_best_response(node, this->hero, this->villain,
-                                                            vrp_river, nb_local);
-            });
-        }
-        tg.wait();
-
-        size_t idx = 0;
-        for (uint8_t t = 0; t < 52; ++t) {
-            if (overlap(t, board)) continue;
-
-            nb[3] = t;
-            vector<int>& rpm_turn = rangeManager->get_reach_probs_mapping(hero, nb);
-            vector<float> turnEvs(rpm_turn.size(), 0.0f);
-
-            for (uint8_t r = t + 1; r < 52; ++r) {
-                if (overlap(r, board)) continue;
-
-                nb[4] = r;
-
-                vector<int>& rpm_river = rangeManager->get_reach_probs_mapping(hero, nb);
-                vector<float>& sub     = results[idx++];
-
-                for (int k = 0; k < static_cast<int>(sub.size()); ++k)
-                    turnEvs[rpm_river[k]] += sub[k];
-            }
-
-            for (int k = 0; k < static_cast<int>(turnEvs.size()); ++k)
-                evs[rpm_turn[k]] += 2.0f * turnEvs[k];
-
-            nb[3] = 52;
-            nb[4] = 52;
-        }
-
-        for (int i = 0; i < static_cast<int>(evs.size()); ++i) evs[i] /= 1980.0f;
-    }
-
-    return evs;
+    rangeManager->get_allin_equity(boardIndex).get_utilities(hero, node->value, villainReachProbs, evs);
 }
 
-vector<float> BestResponseTask::uncontested_best_response(TerminalNode* node,
-                                                          int hero, int villain,
-                                                          vector<float>& villainReachProbs,
-                                                          uint8_t board[5])
+void BestResponseTask::uncontested_best_response(TerminalNode* node,
+                                                 int hero, int villain,
+                                                 const float* villainReachProbs,
+                                                 int boardIndex, float* evs)
 {
-    vector<Hand>& heroHands    = rangeManager->get_hands(hero, board);
-    vector<Hand>& villainHands = rangeManager->get_hands(villain, board);
-
-    int numHeroHands    = static_cast<int>(heroHands.size());
-    int numVillainHands = static_cast<int>(villainHands.size());
-
-    float villainSum = 0;
-    float villainCardSum[52];
-    memset(villainCardSum, 0, sizeof(villainCardSum));
-
-    for (int i = 0; i < numVillainHands; i++) {
-        villainSum += villainReachProbs[i];
-        villainCardSum[villainHands[i].card1] += villainReachProbs[i];
-        villainCardSum[villainHands[i].card2] += villainReachProbs[i];
-    }
-
-    float value = (hero == node->lastToAct) ? -node->value : node->value;
-
-    vector<float> evs(numHeroHands);
-
-    for (int i = 0; i < numHeroHands; i++) {
-        evs[i] = (villainSum
-            - villainCardSum[heroHands[i].card1]
-            - villainCardSum[heroHands[i].card2]
-            + villainReachProbs[i]) * value;
-    }
-
-    return evs;
+    uncontested_utilities(*rangeManager, *node, hero, villain, villainReachProbs, boardIndex, evs);
 }
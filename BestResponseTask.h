@@ -4,42 +4,60 @@
 #include <vector>
 
 #include "RangeManager.h"
-#include "Node.h"
+#include "GameTree.h"
+#include "NodeRef.h"
+#include "TreeTraversal.h"
 #include "ActionNode.h"
 #include "ChanceNode.h"
 #include "TerminalNode.h"
+#include "StrategySnapshot.h"
 
+// Best response EVs of both players in one traversal. A player's EVs are
+// those of a best response to the other player's average strategy, so
+// they depend on the other player's reach: p1's EVs on p2's reach probs
+// and p2's EVs on p1's. Arrays of two are indexed by player - 1.
+//
+// Buffers passed between tasks are borrowed from the per-thread ScratchArena.
+// A task writes one EV per hand of each player on its board to results,
+// which are owned by the parent. A player without reach left in a subtree
+// gets nullptr reach probs there, and the other player's EVs are 0.
 class BestResponseTask {
 public:
     BestResponseTask(std::shared_ptr<RangeManager> rangeManager,
-                     std::vector<float>* result,
-                     Node* node,
-                     int hero,
-                     int villain,
-                     std::vector<float>* villainReachProbs,
-                     uint8_t board[5]);
+                     float* const results[2],
+                     GameTree* tree,
+                     NodeRef node,
+                     const float* const reachProbs[2],
+                     uint8_t board[5],
+                     int boardIndex,
+                     const StrategySnapshot* strategySnapshot);
 
     // run the computation (replaces old task::execute)
     void run();
 
+    // per node kind handlers, called by dispatch()
+    template <NodeKind kind>
+    void visit(typename NodeOf<kind>::type& node);
+
 private:
     std::shared_ptr<RangeManager> rangeManager;
-    std::vector<float>* result;
-    Node* node;
-    int hero{0};
-    int villain{0};
-    std::vector<float>* villainReachProbs;
+    float* results[2];
+    GameTree* tree;
+    NodeRef node;
+    const float* reachProbs[2];
     uint8_t board[5]{};
+    int boardIndex{0};
+    // average strategies to use instead of the tree's, may be nullptr
+    const StrategySnapshot* strategySnapshot{nullptr};
 
     // helpers
-    std::vector<float> terminal_node_best_response(TerminalNode* node, int hero, int villain,
-                                                   std::vector<float>& villainReachProbs, uint8_t board[5]);
-    std::vector<float> chance_node_best_response(ChanceNode* node, int hero, int villain,
-                                                 std::vector<float>& villainReachProbs, uint8_t board[5]);
-    std::vector<float> showdown_best_response(TerminalNode* node, int hero, int villain,
-                                              std::vector<float>& villainReachProbs, uint8_t board[5]);
-    std::vector<float> allin_best_response(TerminalNode* node, int hero, int villain,
-                                           std::vector<float>& villainReachProbs, uint8_t board[5]);
-    std::vector<float> uncontested_best_response(TerminalNode* node, int hero, int villain,
-                                                 std::vector<float>& villainReachProbs, uint8_t board[5]);
+    template <typename Evaluate>
+    void terminal_best_response(const Evaluate& evaluate);
+    void chance_node_best_response(ChanceNode* node);
+    void showdown_best_response(TerminalNode* node, int hero, int villain,
+                                const float* villainReachProbs, int boardIndex, float* evs);
+    void allin_best_response(TerminalNode* node, int hero, int villain,
+                             const float* villainReachProbs, int boardIndex, float* evs);
+    void uncontested_best_response(TerminalNode* node, int hero, int villain,
+                                   const float* villainReachProbs, int boardIndex, float* evs);
 };
@@ -1,301 +1,205 @@
 #include "CfrTask.h"
 #include "card_utility.h"
-#include "NodeTypeEnum.h"
-#include <tbb/task_group.h>
+#include "ScratchArena.h"
 #include <cstring>
+#include <algorithm>
 
 using std::vector;
 using std::shared_ptr;
+using std::fill;
 
-CfrTask::CfrTask(shared_ptr<RangeManager> rangeManager, vector<float>* result, Node* node,
-                 int hero, int villain, vector<float>* villainReachProbs,
-                 uint8_t board[5], int iterationCount)
+CfrTask::CfrTask(shared_ptr<RangeManager> rangeManager, float* result,
+                 GameTree* tree, NodeRef node, int hero, int villain, const float* villainReachProbs,
+                 uint8_t board[5], int boardIndex, int iterationCount, PruningStats* pruningStats)
 {
     this->rangeManager = rangeManager;
     this->result = result;
+    this->tree = tree;
     this->node = node;
     this->hero = hero;
     this->villain = villain;
     this->villainReachProbs = villainReachProbs;
     for (int i = 0; i < 5; i++) this->board[i] = board[i];
+    this->boardIndex = boardIndex;
     this->iterationCount = iterationCount;
+    this->pruningStats = pruningStats;
 }
 
-void CfrTask::run()
+template <>
+void CfrTask::visit<NodeKind::ALLIN>(TerminalNode& node)
 {
-    if (typeid(*node) == typeid(TerminalNode)) {
-        *result = terminal_node_utility(static_cast<TerminalNode*>(node),
-                                        hero, villain, *villainReachProbs, board, iterationCount);
-        return;
-    }
-
-    if (typeid(*node) == typeid(ChanceNode)) {
-        *result = chance_node_utility(static_cast<ChanceNode*>(node),
-                                      hero, villain, *villainReachProbs, board, iterationCount);
-        return;
-    }
+    allin_utility(&node, hero, villain, villainReachProbs, boardIndex, result);
+}
 
-    ActionNode* actionNode = static_cast<ActionNode*>(node);
+template <>
+void CfrTask::visit<NodeKind::UNCONTESTED>(TerminalNode& node)
+{
+    uncontested_utility(&node, hero, villain, villainReachProbs, boardIndex, result);
+}
 
-    const int numHeroHands    = rangeManager->get_num_hands(hero,    board);
-    const int numVillainHands = rangeManager->get_num_hands(villain, board);
-    const int numActions      = actionNode->numActions;
+template <>
+void CfrTask::visit<NodeKind::SHOWDOWN>(TerminalNode& node)
+{
+    showdown_utility(&node, hero, villain, villainReachProbs, boardIndex, result);
+}
 
-    if (hero == actionNode->player) {
-        *result = vector<float>(numHeroHands, 0.0f);
-        vector<vector<float>> results(numActions);
+template <>
+void CfrTask::visit<NodeKind::CHANCE>(ChanceNode& node)
+{
+    chance_node_utility(&node, hero, villain, villainReachProbs, board, result);
+}
 
-        vector<float> strategy = actionNode->get_current_strategy();
+template <>
+void CfrTask::visit<NodeKind::ACTION>(ActionNode& node)
+{
+    ActionNode* actionNode = &node;
 
-        tbb::task_group tg;
-        for (int action = 0; action < numActions; ++action) {
-            Node* child = actionNode->get_child(action);
-            tg.run([=, this, &results] {
-                CfrTask sub(rangeManager, &results[action], child,
-                            hero, villain, villainReachProbs, board, iterationCount);
-                sub.run();
-            });
-        }
-        tg.wait();
+    const int numHeroHands    = rangeManager->get_num_hands(hero,    boardIndex);
+    const int numVillainHands = rangeManager->get_num_hands(villain, boardIndex);
+    const int numActions      = actionNode->numActions;
 
-        vector<float>& utilities = *result;
+    ScratchFrame frame;
 
-        // update regrets (part one) and compute utility under current strategy
-        for (int action = 0; action < numActions; ++action) {
-            vector<float>& au = results[action];
-            actionNode->update_regretSum_part_one(au, action);
+    if (hero == actionNode->player) {
+        float* results = frame.allocate(numActions * numHeroHands);
+        bool* prunedActions = pruningStats ? get_pruned_actions(actionNode, frame) : nullptr;
 
-            int idx = action * numHeroHands;
-            for (int h = 0; h < numHeroHands; ++h) {
-                utilities[h] += strategy[idx++] * au[h];
+        for_each_child(tree, node, numActions, [&](int action) {
+            if (prunedActions && prunedActions[action]) {
+                fill(results + action * numHeroHands, results + (action + 1) * numHeroHands, 0.0f);
+                return;
             }
-        }
+            CfrTask sub(rangeManager, results + action * numHeroHands, tree, tree->get_child(*actionNode, action),
+                        hero, villain, villainReachProbs, board, boardIndex, iterationCount, pruningStats);
+            sub.run();
+        });
 
-        actionNode->update_regretSum_part_two(*result, iterationCount);
+        // utility under the current strategy and the regret update, fused
+        actionNode->update_regretSum(results, result, iterationCount, prunedActions);
     } else {
-        *result = vector<float>(numHeroHands, 0.0f);
-        vector<vector<float>> results(numActions);
-        vector<vector<float>> newVRPs(numActions);
+        float* results = frame.allocate(numActions * numHeroHands);
+        float* newVRPs = frame.allocate(numActions * numVillainHands);
 
-        vector<float> strategy = actionNode->get_current_strategy();
+        // per-action villain reach probs and the strategy sum update, fused;
+        // the children never read this node's strategySum
+        actionNode->update_strategySum(villainReachProbs, newVRPs, iterationCount);
 
-        // build per-action villain reach probs
-        for (int action = 0; action < numActions; ++action) {
-            newVRPs[action].resize(numVillainHands);
-            vector<float>& nv = newVRPs[action];
-            int idx = action * numVillainHands;
-            for (int h = 0; h < numVillainHands; ++h) {
-                nv[h] = strategy[idx++] * (*villainReachProbs)[h];
+        for_each_child(tree, node, numActions, [&](int action) {
+            if (!has_reach(newVRPs + action * numVillainHands, numVillainHands)) {
+                fill(results + action * numHeroHands, results + (action + 1) * numHeroHands, 0.0f);
+                return;
             }
-        }
-
-        tbb::task_group tg;
-        for (int action = 0; action < numActions; ++action) {
-            Node* child = actionNode->get_child(action);
-            tg.run([=, this, &results, &newVRPs] {
-                CfrTask sub(rangeManager, &results[action], child,
-                            hero, villain, &newVRPs[action], board, iterationCount);
-                sub.run();
-            });
-        }
-        tg.wait();
+            CfrTask sub(rangeManager, results + action * numHeroHands, tree, tree->get_child(*actionNode, action),
+                        hero, villain, newVRPs + action * numVillainHands, board, boardIndex, iterationCount, pruningStats);
+            sub.run();
+        });
 
-        vector<float>& utilities = *result;
+        float* utilities = result;
+        fill(utilities, utilities + numHeroHands, 0.0f);
         for (int action = 0; action < numActions; ++action) {
-            vector<float>& su = results[action];
+            const float* su = results + action * numHeroHands;
             for (int h = 0; h < numHeroHands; ++h) {
                 utilities[h] += su[h];
             }
         }
+    }
+}
 
-        actionNode->update_strategySum(strategy, *villainReachProbs, iterationCount);
+void CfrTask::run()
+{
+    dispatch(tree, node, *this);
+}
+
+bool* CfrTask::get_pruned_actions(ActionNode* actionNode, ScratchFrame& frame)
+{
+    const int numActions = actionNode->numActions;
+
+    bool* prunedActions = frame.allocate_array<bool>(numActions);
+    if (actionNode->get_unplayed_actions(prunedActions) == 0)
+        return nullptr;
+
+    for (int action = 0; action < numActions; ++action) {
+        if (prunedActions[action]) {
+            pruningStats->prunedSubtrees.fetch_add(1, std::memory_order_relaxed);
+            pruningStats->prunedCost.fetch_add((uint64_t)tree->get_subtree_cost(tree->get_child(*actionNode, action)),
+                                               std::memory_order_relaxed);
+        }
     }
+
+    return prunedActions;
 }
 
-vector<float> CfrTask::chance_node_utility(ChanceNode* node, int hero, int villain,
-                                           vector<float>& villainReachProbs, uint8_t board[5], int /*iterationCount*/)
+void CfrTask::chance_node_utility(ChanceNode* node, int hero, int villain,
+                                  const float* villainReachProbs, uint8_t board[5], float* utilities)
 {
-    vector<Hand>& heroHands    = rangeManager->get_hands(hero, board);
-    vector<unique_ptr<ChanceNodeChild>>& children = node->get_children();
-    const int childCount = static_cast<int>(children.size());
+    ChanceNodeChild* children = tree->get_children(*node);
+    const int childCount = node->childCount;
 
-    vector<vector<float>> results(childCount);
-    vector<vector<float>> newVRPs(childCount);
+    ScratchFrame frame;
+    float** results = frame.allocate_array<float*>(childCount);
+    float** newVRPs = frame.allocate_array<float*>(childCount);
+    int* boardIndices = frame.allocate_array<int>(childCount);
 
     // precompute per-child villain reach probs
     for (int i = 0; i < childCount; ++i) {
         uint8_t nb[5];
         for (int j = 0; j < 5; ++j) nb[j] = board[j];
 
-        const uint8_t card = children[i]->card;
+        const uint8_t card = children[i].card;
         if (board[3] == 52) nb[3] = card; else nb[4] = card;
 
-        newVRPs[i] = rangeManager->get_reach_probs(villain, nb, villainReachProbs);
-    }
-
-    tbb::task_group tg;
-    for (int i = 0; i < childCount; ++i) {
-        Node* child = children[i]->node.get();
-        tg.run([=, this, &results, &newVRPs, &children] {
-            uint8_t nb[5];
-            for (int j = 0; j < 5; ++j) nb[j] = board[j];
-
-            const uint8_t card = children[i]->card;
-            if (board[3] == 52) nb[3] = card; else nb[4] = card;
-
-            CfrTask sub(rangeManager, &results[i], child,
-                        hero, villain, &newVRPs[i], nb, iterationCount);
-            sub.run();
-        });
+        boardIndices[i] = RangeManager::get_board_index(nb);
+        results[i] = frame.allocate(rangeManager->get_num_hands(hero, boardIndices[i]));
+        newVRPs[i] = frame.allocate(rangeManager->get_num_hands(villain, boardIndices[i]));
+        rangeManager->get_reach_probs(villain, boardIndices[i], villainReachProbs, newVRPs[i]);
     }
-    tg.wait();
 
-    vector<float> utilities(heroHands.size(), 0.0f);
+    for_each_child(tree, *node, childCount, [&](int i) {
+        if (!has_reach(newVRPs[i], rangeManager->get_num_hands(villain, boardIndices[i]))) {
+            fill(results[i], results[i] + rangeManager->get_num_hands(hero, boardIndices[i]), 0.0f);
+            return;
+        }
 
-    uint8_t nb[5];
-    for (int j = 0; j < 5; ++j) nb[j] = board[j];
+        uint8_t nb[5];
+        for (int j = 0; j < 5; ++j) nb[j] = board[j];
 
-    for (int i = 0; i < childCount; ++i) {
-        const uint8_t card = children[i]->card;
+        const uint8_t card = children[i].card;
         if (board[3] == 52) nb[3] = card; else nb[4] = card;
 
-        vector<float>& su = results[i];
-        vector<int>& rpm  = rangeManager->get_reach_probs_mapping(hero, nb);
-
-        for (int k = 0; k < static_cast<int>(su.size()); ++k)
-            utilities[rpm[k]] += su[k];
-    }
-
-    const int weight = (board[3] == 52) ? 45 : 44;
-    for (int h = 0; h < static_cast<int>(utilities.size()); ++h) utilities[h] /= weight;
-
-    return utilities;
-}
+        CfrTask sub(rangeManager, results[i], tree, children[i].node,
+                    hero, villain, newVRPs[i], nb, boardIndices[i], iterationCount, pruningStats);
+        sub.run();
+    });
 
-vector<float> CfrTask::terminal_node_utility(TerminalNode* node, int hero, int villain,
-                                             vector<float>& villainReachProbs, uint8_t board[5], int iterationCount)
-{
-    if (node->type == TerminalNodeType::ALLIN)
-        return allin_utility(node, hero, villain, villainReachProbs, board, iterationCount);
-    else if (node->type == TerminalNodeType::UNCONTESTED)
-        return uncontested_utility(node, hero, villain, villainReachProbs, board, iterationCount);
-    else
-        return showdown_utility(node, hero, villain, villainReachProbs, board, iterationCount);
+    combine_chance_results(tree, *rangeManager, *node, hero, board, boardIndex, boardIndices, results, 1, utilities);
 }
 
-vector<float> CfrTask::allin_utility(TerminalNode* node, int hero, int villain,
-                                     vector<float>& villainReachProbs, uint8_t board[5], int /*iterationCount*/)
+void CfrTask::allin_utility(TerminalNode* node, int hero, int villain,
+                            const float* villainReachProbs, int boardIndex, float* evs)
 {
-    vector<Hand>& heroHands = rangeManager->get_hands(hero, board);
-    vector<float> evs(heroHands.size(), 0.0f);
-
-    uint8_t nb[5];
-    for (int j = 0; j < 5; ++j) nb[j] = board[j];
-
-    if (nb[3] != 52) {
-        // rivers only
-        vector<vector<float>> results;
-        results.reserve(44);
-
-        tbb::task_group tg;
-        vector<uint8_t> rivers;
-        for (uint8_t r = 0; r < 52; ++r) if (!overlap(r, board)) rivers.push_back(r);
-        results.resize(rivers.size());
-
-        for (size_t i = 0; i < rivers.size(); ++i) {
-            tg.run([=, this, &results, &rivers] {
-                uint8_t local[5];
-                for (int j = 0; j < 5; ++j) local[j] = nb[j];
-                local[4] = rivers[i];
-
-                vector<float> vrp = rangeManager->get_reach_probs(villain, local, villainReachProbs);
-                results[i] = showdown_utility(node, hero, villain, vrp, local, 0);
-            });
-        }
-        tg.wait();
-
-        size_t idx = 0;
-        for (uint8_t r : rivers) {
-            nb[4] = r;
-            vector<int>& rpm = rangeManager->get_reach_probs_mapping(hero, nb);
-            vector<float>& sub = results[idx++];
-            for (int k = 0; k < static_cast<int>(sub.size()); ++k)
-                evs[rpm[k]] += sub[k];
-        }
-        for (int i = 0; i < static_cast<int>(evs.size()); ++i) evs[i] /= 44.0f;
-    } else {
-        // turn+river pairs
-        vector<std::pair<uint8_t,uint8_t>> pairs;
-        for (uint8_t t = 0; t < 52; ++t) {
-            if (overlap(t, board)) continue;
-            for (uint8_t r = t + 1; r < 52; ++r) {
-                if (overlap(r, board)) continue;
-                pairs.emplace_back(t, r);
-            }
-        }
-
-        vector<vector<float>> results(pairs.size());
-        tbb::task_group tg;
-
-        for (size_t i = 0; i < pairs.size(); ++i) {
-            tg.run([=, this, &results, &pairs] {
-                uint8_t local[5];
-                for (int j = 0; j < 5; ++j) local[j] = nb[j];
-
-                local[3] = pairs[i].first;
-                vector<float> vrp_turn = rangeManager->get_reach_probs(villain, local, villainReachProbs);
-
-                local[4] = pairs[i].second;
-                vector<float> vrp_river = rangeManager->get_reach_probs(villain, local, vrp_turn);
-
-                results[i] = showdown_utility(node, hero, villain, vrp_river, local, 0);
-            });
-        }
-        tg.wait();
-
-        size_t idx = 0;
-        for (uint8_t t = 0; t < 52; ++t) {
-            if (overlap(t, board)) continue;
-
-            nb[3] = t;
-            vector<int>& rpm_turn = rangeManager->get_reach_probs_mapping(hero, nb);
-            vector<float> turnEvs(rpm_turn.size(), 0.0f);
-
-            for (uint8_t r = t + 1; r < 52; ++r) {
-                if (overlap(r, board)) continue;
-
-                nb[4] = r;
-
-                vector<int>& rpm_river = rangeManager->get_reach_probs_mapping(hero, nb);
-                vector<float>& sub = results[idx++];
-
-                for (int k = 0; k < static_cast<int>(sub.size()); ++k)
-                    turnEvs[rpm_river[k]] += sub[k];
-            }
-
-            for (int k = 0; k < static_cast<int>(turnEvs.size()); ++k)
-                evs[rpm_turn[k]] += 2.0f * turnEvs[k];
-
-            nb[3] = 52;
-            nb[4] = 52;
-        }
-
-        for (int i = 0; i < static_cast<int>(evs.size()); ++i) evs[i] /= 1980.0f;
+    if (!has_reach(villainReachProbs, rangeManager->get_num_hands(villain, boardIndex))) {
+        fill(evs, evs + rangeManager->get_num_hands(hero, boardIndex), 0.0f);
+        return;
     }
 
-    return evs;
+    rangeManager->get_allin_equity(boardIndex).get_utilities(hero, node->value, villainReachProbs, evs);
 }
 
-vector<float> CfrTask::showdown_utility(TerminalNode* node, const int hero, const int villain,
-                                        const vector<float>& villainReachProbs, uint8_t board[5], const int /*iterationCount*/)
+void CfrTask::showdown_utility(TerminalNode* node, const int hero, const int villain,
+                               const float* villainReachProbs, int boardIndex, float* utilities)
 {
-    vector<Hand>& heroHands    = rangeManager->get_hands(hero, board);
-    vector<Hand>& villainHands = rangeManager->get_hands(villain, board);
+    Hand* heroHands          = rangeManager->get_hands(hero, boardIndex);
+    const Hand* villainHands = rangeManager->get_hands(villain, boardIndex);
 
-    int numHeroHands    = (int)heroHands.size();
-    int numVillainHands = (int)villainHands.size();
+    int numHeroHands    = rangeManager->get_num_hands(hero, boardIndex);
+    int numVillainHands = rangeManager->get_num_hands(villain, boardIndex);
 
-    vector<float> utilities(heroHands.size());
+    // the sweep only visits villain hands with reach
+    ScratchFrame frame;
+    if (compact_reach(villainHands, villainReachProbs, numVillainHands, frame) == 0) {
+        fill(utilities, utilities + numHeroHands, 0.0f);
+        return;
+    }
 
     float value = node->value;
 
@@ -343,37 +247,10 @@ vector<float> CfrTask::showdown_utility(TerminalNode* node, const int hero, cons
 
         i = m;
     }
-
-    return utilities;
 }
 
-vector<float> CfrTask::uncontested_utility(TerminalNode* node, int hero, int villain,
-                                           vector<float>& villainReachProbs, uint8_t board[5], int /*iterationCount*/)
+void CfrTask::uncontested_utility(TerminalNode* node, int hero, int villain,
+                                  const float* villainReachProbs, int boardIndex, float* utilities)
 {
-    vector<Hand>& heroHands    = rangeManager->get_hands(hero, board);
-    vector<Hand>& villainHands = rangeManager->get_hands(villain, board);
-
-    int numHeroHands    = (int)heroHands.size();
-    int numVillainHands = (int)villainHands.size();
-
-    float villainSum = 0.0f;
-    float villainCardSum[52];
-    std::memset(villainCardSum, 0, sizeof(villainCardSum));
-
-    for (int i = 0; i < numVillainHands; ++i) {
-        villainCardSum[villainHands[i].card1] += villainReachProbs[i];
-        villainCardSum[villainHands[i].card2] += villainReachProbs[i];
-        villainSum += villainReachProbs[i];
-    }
-
-    float value = (hero == node->lastToAct) ? -node->value : node->value;
-
-    vector<float> utilities(numHeroHands);
-    for (int i = 0; i < numHeroHands; ++i) {
-        utilities[i] = (villainSum
-            - villainCardSum[heroHands[i].card1]
-            - villainCardSum[heroHands[i].card2]
-            + villainReachProbs[i]) * value;
-    }
-    return utilities;
+    uncontested_utilities(*rangeManager, *node, hero, villain, villainReachProbs, boardIndex, utilities);
 }
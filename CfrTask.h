@@ -1,46 +1,74 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <vector>
 
 #include "RangeManager.h"
-#include "Node.h"
+#include "GameTree.h"
+#include "NodeRef.h"
+#include "TreeTraversal.h"
 #include "ActionNode.h"
 #include "ChanceNode.h"
 #include "TerminalNode.h"
 
+class ScratchFrame;
+
+// Work skipped by regret based pruning, in the hand visits of
+// Node::subtreeCost. Shared by every task of a traversal.
+struct PruningStats {
+    std::atomic<uint64_t> prunedSubtrees{0};
+    std::atomic<uint64_t> prunedCost{0};
+};
+
+// Buffers passed between tasks are borrowed from the per-thread ScratchArena.
+// A task writes one utility per hero hand on its board to result, which is
+// owned by the parent.
 class CfrTask {
 public:
     CfrTask(std::shared_ptr<RangeManager> rangeManager,
-            std::vector<float>* result,
-            Node* node,
+            float* result,
+            GameTree* tree,
+            NodeRef node,
             int hero, int villain,
-            std::vector<float>* villainReachProbs,
+            const float* villainReachProbs,
             uint8_t board[5],
-            int iterationCount);
+            int boardIndex,
+            int iterationCount,
+            PruningStats* pruningStats = nullptr);
 
     // run the computation (replaces old task::execute)
     void run();
 
+    // per node kind handlers, called by dispatch()
+    template <NodeKind kind>
+    void visit(typename NodeOf<kind>::type& node);
+
 private:
     std::shared_ptr<RangeManager> rangeManager;
-    std::vector<float>* result;
-    Node* node;
+    float* result;
+    GameTree* tree;
+    NodeRef node;
     int hero{0};
     int villain{0};
-    std::vector<float>* villainReachProbs;
+    const float* villainReachProbs;
     uint8_t board[5]{};
+    int boardIndex{0};
     int iterationCount{0};
 
+    // Set when this traversal prunes: a hero action whose current strategy
+    // is 0 for every hand is skipped, since the node utility doesn't depend
+    // on it.
+    PruningStats* pruningStats{nullptr};
+
     // helpers
-    std::vector<float> chance_node_utility(ChanceNode* node, int hero, int villain,
-                                           std::vector<float>& villainReachProbs, uint8_t board[5], int iterationCount);
-    std::vector<float> terminal_node_utility(TerminalNode* node, int hero, int villain,
-                                             std::vector<float>& villainReachProbs, uint8_t board[5], int iterationCount);
-    std::vector<float> allin_utility(TerminalNode* node, int hero, int villain,
-                                     std::vector<float>& villainReachProbs, uint8_t board[5], int iterationCount);
-    std::vector<float> showdown_utility(TerminalNode* node, const int hero, const int villain,
-                                        const std::vector<float>& villainReachProbs, uint8_t board[5], const int iterationCount);
-    std::vector<float> uncontested_utility(TerminalNode* node, int hero, int villain,
-                                           std::vector<float>& villainReachProbs, uint8_t board[5], int iterationCount);
+    bool* get_pruned_actions(ActionNode* actionNode, ScratchFrame& frame);
+    void chance_node_utility(ChanceNode* node, int hero, int villain,
+                             const float* villainReachProbs, uint8_t board[5], float* utilities);
+    void allin_utility(TerminalNode* node, int hero, int villain,
+                       const float* villainReachProbs, int boardIndex, float* utilities);
+    void showdown_utility(TerminalNode* node, const int hero, const int villain,
+                          const float* villainReachProbs, int boardIndex, float* utilities);
+    void uncontested_utility(TerminalNode* node, int hero, int villain,
+                             const float* villainReachProbs, int boardIndex, float* utilities);
 };
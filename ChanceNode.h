@@ -2,23 +2,15 @@
 #define CHANCE_NODE_H
 
 #include "Node.h"
-#include <memory>
-#include <vector>
-#include "ChanceNodeChild.h"
 #include "ChanceNodeTypeEnum.h"
-using std::unique_ptr;
-using std::vector;
 
 class ChanceNode : public Node
 {
-    private:
-        vector<unique_ptr<ChanceNodeChild>> children;
-
     public:
         ChanceNodeType type;
-        ChanceNode(Node* parent, ChanceNodeType type);
-        void add_child(unique_ptr<Node> child, uint8_t card);
-        vector<unique_ptr<ChanceNodeChild>>& get_children();
+        int firstChild = 0; // index of the first child in GameTree::chanceNodeChildren
+        int childCount = 0;
+        ChanceNode(ChanceNodeType type);
 };
 
-#endif
\ No newline at end of file
+#endif
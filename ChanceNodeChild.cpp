@@ -1,9 +1,7 @@
 #include "ChanceNodeChild.h"
 
-using std::move;
-
-ChanceNodeChild::ChanceNodeChild(unique_ptr<Node> node, uint8_t card)
+ChanceNodeChild::ChanceNodeChild(NodeRef node, uint8_t card)
 {
-    this->node = move(node);
+    this->node = node;
     this->card = card;
-}
\ No newline at end of file
+}
@@ -1,16 +1,22 @@
 #ifndef CHANCE_NODE_CHILD_H
 #define CHANCE_NODE_CHILD_H
 
-#include "Node.h"
-#include <memory>
-using std::unique_ptr;
+#include "NodeRef.h"
+#include <stdint.h>
 
 class ChanceNodeChild
 {
     public:
 		uint8_t card;
-        unique_ptr<Node> node;
-        ChanceNodeChild(unique_ptr<Node> node, uint8_t card);
+        NodeRef node;
+
+        // Suit permutations (in GameTree::isomorphisms) that map card onto
+        // the other cards of its orbit. Those cards have no subtree of their
+        // own, their results are this child's results on permuted hands.
+        int firstIsomorphism = 0;
+        int isomorphismCount = 0;
+
+        ChanceNodeChild(NodeRef node, uint8_t card);
 };
 
-#endif
\ No newline at end of file
+#endif
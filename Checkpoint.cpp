@@ -0,0 +1,242 @@
+#include "Checkpoint.h"
+#include "GameTree.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using std::runtime_error;
+using std::min;
+
+// bytes copied per step of a resume, 64 MB
+static const size_t READ_CHUNK_SIZE = 1 << 26;
+
+static void write_all(int fd, const void* data, size_t bytes, const string& path)
+{
+    const char* p = (const char*) data;
+    while (bytes > 0)
+    {
+        ssize_t written = ::write(fd, p, bytes);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error("Could not write " + path);
+        }
+        p += written;
+        bytes -= written;
+    }
+}
+
+void Checkpoint::write(const string& path, uint64_t fingerprint, int iteration, const uint8_t* storage, size_t storageSize)
+{
+    string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw runtime_error("Could not open " + tmpPath);
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.fingerprint = fingerprint;
+    header.iteration = iteration;
+    header.storageSize = storageSize;
+
+    try
+    {
+        write_all(fd, &header, sizeof(header), tmpPath);
+        write_all(fd, storage, storageSize, tmpPath);
+        if (fsync(fd) != 0)
+            throw runtime_error("Could not sync " + tmpPath);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    if (rename(tmpPath.c_str(), path.c_str()) != 0)
+        throw runtime_error("Could not rename " + tmpPath + " to " + path);
+}
+
+int Checkpoint::read(const string& path, GameTree* tree)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Could not open " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader))
+    {
+        close(fd);
+        throw runtime_error(path + " is not a checkpoint");
+    }
+
+    size_t mappedBytes = st.st_size;
+    void* mapping = mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        throw runtime_error("Could not map " + path);
+
+    CheckpointHeader header;
+    memcpy(&header, mapping, sizeof(header));
+
+    const char* problem = nullptr;
+    if (header.magic != MAGIC)
+        problem = " is not a checkpoint";
+    else if (header.version != VERSION)
+        problem = " was written by an incompatible version";
+    else if (header.fingerprint != tree->get_fingerprint() || header.storageSize != tree->storage.size())
+        problem = " was written for a different tree";
+    else if (mappedBytes != sizeof(header) + header.storageSize)
+        problem = " is truncated";
+
+    if (problem)
+    {
+        munmap(mapping, mappedBytes);
+        throw runtime_error(path + problem);
+    }
+
+    madvise(mapping, mappedBytes, MADV_SEQUENTIAL);
+
+    // copy chunk by chunk and give the pages back right away, so a large
+    // tree is never held twice in memory
+    const uint8_t* data = (const uint8_t*) mapping + sizeof(header);
+    for (size_t start = 0; start < header.storageSize; start += READ_CHUNK_SIZE)
+    {
+        size_t count = min(READ_CHUNK_SIZE, (size_t)header.storageSize - start);
+        memcpy(&tree->storage[start], data + start, count);
+
+        // madvise wants a page aligned start, keep the partial first page
+        size_t end = sizeof(header) + start + count;
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        madvise(mapping, end / pageSize * pageSize, MADV_DONTNEED);
+    }
+
+    munmap(mapping, mappedBytes);
+    return header.iteration;
+}
+
+CheckpointWriter::CheckpointWriter(string path, uint64_t fingerprint)
+{
+    this->path = path;
+    this->fingerprint = fingerprint;
+    thread = std::thread([this] { run(); });
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+bool CheckpointWriter::save(const uint8_t* storage, size_t storageSize, int iteration)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error.empty())
+    {
+        string message = error;
+        error.clear();
+        throw runtime_error(message);
+    }
+
+    if (pending)
+        return false;
+
+    // the child reports a failed write through the pipe
+    int errorPipe[2];
+    if (pipe(errorPipe) != 0)
+        throw runtime_error("Could not create a pipe for " + path);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(errorPipe[0]);
+        close(errorPipe[1]);
+        throw runtime_error("Could not fork to write " + path);
+    }
+
+    if (pid == 0)
+    {
+        close(errorPipe[0]);
+        string message;
+        try
+        {
+            Checkpoint::write(path, fingerprint, iteration, storage, storageSize);
+        }
+        catch (const std::exception& e)
+        {
+            message = e.what();
+        }
+        if (!message.empty() && ::write(errorPipe[1], message.data(), message.size()) < 0)
+            _exit(2);
+        _exit(message.empty() ? 0 : 1);
+    }
+
+    close(errorPipe[1]);
+    pendingPid = pid;
+    pendingErrorFd = errorPipe[0];
+    pending = true;
+    condition.notify_all();
+    return true;
+}
+
+void CheckpointWriter::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return !pending; });
+    if (!error.empty())
+    {
+        string message = error;
+        error.clear();
+        throw runtime_error(message);
+    }
+}
+
+void CheckpointWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this] { return pending || stopping; });
+        if (!pending)
+            return;
+
+        pid_t pid = pendingPid;
+        int errorFd = pendingErrorFd;
+        lock.unlock();
+
+        string writeError;
+        char buffer[256];
+        ssize_t bytes;
+        while ((bytes = read(errorFd, buffer, sizeof(buffer))) != 0)
+        {
+            if (bytes > 0)
+                writeError.append(buffer, bytes);
+            else if (errno != EINTR)
+                break;
+        }
+        close(errorFd);
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (writeError.empty() && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+            writeError = "Checkpoint writer for " + path + " failed";
+        lock.lock();
+
+        error = writeError;
+        pending = false;
+        condition.notify_all();
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+using std::string;
+
+class GameTree;
+
+// On disk a checkpoint is a CheckpointHeader followed by a copy of
+// GameTree::storage, which holds the regretSum and strategySum blocks of
+// every ActionNode in the tree's storage type. The fingerprint ties it to
+// the shape of the tree it was written from, so it can only be resumed into
+// an identical tree.
+struct CheckpointHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fingerprint;
+    uint64_t iteration;
+    uint64_t storageSize; // bytes
+};
+
+class Checkpoint
+{
+    public:
+        static const uint32_t MAGIC = 0x4b435350; // "PSCK"
+        static const uint32_t VERSION = 4;
+
+        // Writes to path + ".tmp" and renames it over path once complete, so
+        // a crash while writing leaves the previous checkpoint intact.
+        static void write(const string& path, uint64_t fingerprint, int iteration, const uint8_t* storage, size_t storageSize);
+
+        // Maps the checkpoint and streams it into the tree's storage, dropping
+        // each chunk from the mapping once copied. Returns the iteration count.
+        static int read(const string& path, GameTree* tree);
+};
+
+// Writes checkpoints in the background. save() forks at an iteration
+// boundary and the child process writes its copy-on-write image of the
+// storage while training goes on, so nothing is copied up front and the
+// training thread never waits for the disk. Pages training modifies while
+// the child is still writing are duplicated by the kernel, at most one
+// storage's worth for the length of a write. A background thread waits for
+// the child and collects its error.
+class CheckpointWriter
+{
+    private:
+        string path;
+        uint64_t fingerprint;
+
+        pid_t pendingPid = -1;
+        int pendingErrorFd = -1;
+        bool pending = false;
+        bool stopping = false;
+        string error;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::thread thread;
+
+        void run();
+
+    public:
+        CheckpointWriter(string path, uint64_t fingerprint);
+        ~CheckpointWriter();
+
+        // Returns false without writing while the previous checkpoint is
+        // still being written. Rethrows the error of a failed write.
+        bool save(const uint8_t* storage, size_t storageSize, int iteration);
+
+        // blocks until the last saved checkpoint is on disk
+        void wait();
+};
+
+#endif
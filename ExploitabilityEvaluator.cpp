@@ -0,0 +1,89 @@
+#include "ExploitabilityEvaluator.h"
+#include <stdexcept>
+#include <tbb/task_arena.h>
+using std::runtime_error;
+
+ExploitabilityEvaluator::ExploitabilityEvaluator(shared_ptr<RangeManager> rangeManager, GameTree* tree, uint8_t initialBoard[5],
+    int initialPot, int inPositionPlayer, int threadCount, Callback callback)
+{
+    br = std::make_unique<BestResponse>(rangeManager, tree, initialBoard, initialPot, inPositionPlayer);
+    br->strategySnapshot = &snapshot;
+    this->threadCount = threadCount;
+    this->callback = callback;
+    thread = std::thread([this] { run(); });
+}
+
+ExploitabilityEvaluator::~ExploitabilityEvaluator()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+bool ExploitabilityEvaluator::evaluate(GameTree* tree, int iteration)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error.empty())
+    {
+        string message = error;
+        error.clear();
+        throw runtime_error(message);
+    }
+
+    if (pending)
+        return false;
+
+    snapshot.take(tree, iteration);
+    pending = true;
+    condition.notify_all();
+    return true;
+}
+
+void ExploitabilityEvaluator::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return !pending; });
+    if (!error.empty())
+    {
+        string message = error;
+        error.clear();
+        throw runtime_error(message);
+    }
+}
+
+void ExploitabilityEvaluator::run()
+{
+    // this thread joins the arena as its master, so the best response runs
+    // even when TBB has no spare worker threads
+    tbb::task_arena arena(threadCount);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this] { return pending || stopping; });
+        if (!pending)
+            return;
+
+        // the snapshot is only touched by evaluate() while nothing is pending
+        lock.unlock();
+        string evaluateError;
+        try
+        {
+            float exploitability = 0;
+            arena.execute([&] { exploitability = br->get_exploitability(); });
+            callback(snapshot.iteration, exploitability);
+        }
+        catch (const std::exception& e)
+        {
+            evaluateError = e.what();
+        }
+        lock.lock();
+
+        error = evaluateError;
+        pending = false;
+        condition.notify_all();
+    }
+}
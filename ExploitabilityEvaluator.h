@@ -0,0 +1,55 @@
+#ifndef EXPLOITABILITY_EVALUATOR_H
+#define EXPLOITABILITY_EVALUATOR_H
+
+#include "BestResponse.h"
+#include "StrategySnapshot.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+using std::string;
+using std::unique_ptr;
+
+// Computes the exploitability of the average strategy on a background
+// thread while training continues. evaluate() snapshots the strategy and
+// returns; the best response runs in its own TBB arena of at most
+// threadCount threads, so it takes a bounded share of the cores from
+// training. The result goes to the callback, on the background thread,
+// with the iteration of the snapshot.
+class ExploitabilityEvaluator
+{
+    public:
+        typedef std::function<void(int iteration, float exploitability)> Callback;
+
+    private:
+        unique_ptr<BestResponse> br;
+        StrategySnapshot snapshot;
+        int threadCount;
+        Callback callback;
+
+        bool pending = false;
+        bool stopping = false;
+        string error;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::thread thread;
+
+        void run();
+
+    public:
+        ExploitabilityEvaluator(shared_ptr<RangeManager> rangeManager, GameTree* tree, uint8_t initialBoard[5], int initialPot,
+            int inPositionPlayer, int threadCount, Callback callback);
+        ~ExploitabilityEvaluator();
+
+        // Returns false without taking a snapshot while the previous
+        // evaluation is still running. Rethrows the error of a failed one.
+        bool evaluate(GameTree* tree, int iteration);
+
+        // blocks until the last evaluation has called back
+        void wait();
+};
+
+#endif
@@ -4,152 +4,301 @@
 #include <iostream>
 #include "card_utility.h"
 #include "NodeTypeEnum.h"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
 
-using std::make_unique;
 using std::min;
 using std::cout;
+using std::move;
+using std::to_string;
+using std::runtime_error;
+using std::ostringstream;
 
-int flopActionNodeCount = 0;
-int turnActionNodeCount = 0;
-int riverActionNodeCount = 0;
-int chanceNodeCount = 0;
-int allinNodeCount = 0;
-int showdownNodeCount = 0;
-int uncontestedNodeCount = 0;
+void GameTree::NodeCounts::add_action_node(Street street)
+{
+    if (street == Street::FLOP)
+        flopActionNodes++;
+    else if (street == Street::TURN)
+        turnActionNodes++;
+    else if (street == Street::RIVER)
+        riverActionNodes++;
+}
 
 GameTree::GameTree(unique_ptr<TreeBuildSettings> treeBuildSettings)
 {
     this->treeBuildSettings = move(treeBuildSettings);
 }
 
-void GameTree::print_tree(Node* node, int tabCount)
+void GameTree::print_tree(NodeRef ref, int tabCount)
 {
-    if (node->type == NodeType::ACTION)
+    if (ref.kind == NodeKind::ACTION)
     {
-        ActionNode* actionNode = static_cast<ActionNode*>(node);
+        ActionNode& actionNode = actionNodes[ref.index];
 
-        auto actionIt = begin(actionNode->actions);
-        for (auto childIt = begin(actionNode->children); childIt != end(actionNode->children); childIt++)
+        for (int i = 0; i < actionNode.numActions; i++)
         {
-            Action* action = actionIt->get();
-            Node* child = childIt->get();
+            Action& action = get_action(actionNode, i);
+            NodeRef child = get_child(actionNode, i);
 
             for (int i = 0; i < tabCount; i++)
             cout << "    ";
 
-            if (action->type == ActionType::FOLD)
-                cout << "p" << actionNode->player << ": FOLD\n";
-            else if (action->type == ActionType::CHECK)
-                cout << "p" << actionNode->player << ": CHECK\n";
-            else if (action->type == ActionType::CALL)
-                cout << "p" << actionNode->player << ": CALL " << action->amount << "\n";
-            else if (action->type == ActionType::BET)
-                cout << "p" << actionNode->player << ": BET " << action->amount << "\n";
-            if (action->type == ActionType::RAISE)
-                cout << "p" << actionNode->player << ": RAISE " << action->amount << "\n";
+            if (action.type == ActionType::FOLD)
+                cout << "p" << actionNode.player << ": FOLD\n";
+            else if (action.type == ActionType::CHECK)
+                cout << "p" << actionNode.player << ": CHECK\n";
+            else if (action.type == ActionType::CALL)
+                cout << "p" << actionNode.player << ": CALL " << action.amount << "\n";
+            else if (action.type == ActionType::BET)
+                cout << "p" << actionNode.player << ": BET " << action.amount << "\n";
+            if (action.type == ActionType::RAISE)
+                cout << "p" << actionNode.player << ": RAISE " << action.amount << "\n";
 
             print_tree(child, tabCount+1);
-            actionIt++;
         }
     }
-    else if (node->type == NodeType::CHANCE)
+    else if (ref.kind == NodeKind::CHANCE)
     {
         for (int i = 0; i < tabCount; i++)
             cout << "    ";
 
-        ChanceNode* chanceNode = static_cast<ChanceNode*>(node);
-        if (chanceNode->type == ChanceNodeType::DEAL_TURN)
+        ChanceNode& chanceNode = chanceNodes[ref.index];
+        if (chanceNode.type == ChanceNodeType::DEAL_TURN)
             cout << "DEAL_TURN\n";
-        else if (chanceNode->type == ChanceNodeType::DEAL_RIVER)
+        else if (chanceNode.type == ChanceNodeType::DEAL_RIVER)
             cout << "DEAL_RIVER\n";
 
-        print_tree(chanceNode->get_children().at(0)->node.get(), tabCount+1);
+        print_tree(get_children(chanceNode)[0].node, tabCount+1);
     }
     else
     {
         for (int i = 0; i < tabCount; i++)
             cout << "    ";
 
-        TerminalNode* terminalNode = static_cast<TerminalNode*>(node);
-        if (terminalNode->type == TerminalNodeType::ALLIN)
+        TerminalNode& terminalNode = terminalNodes[ref.index];
+        if (terminalNode.type == TerminalNodeType::ALLIN)
             cout << "ALLIN: ";
-        else if (terminalNode->type == TerminalNodeType::UNCONTESTED)
+        else if (terminalNode.type == TerminalNodeType::UNCONTESTED)
             cout << "UNCONTESTED: ";
-        else if (terminalNode->type == TerminalNodeType::SHOWDOWN)
+        else if (terminalNode.type == TerminalNodeType::SHOWDOWN)
             cout << "SHOWDOWN: ";
-        cout << "POT: " << terminalNode->value * 2 << " LAST_TO_ACT: p" << terminalNode->lastToAct << "\n";
+        cout << "POT: " << terminalNode.value * 2 << " LAST_TO_ACT: p" << terminalNode.lastToAct << "\n";
     }
 }
 
-unique_ptr<Node> GameTree::build()
+NodeRef GameTree::build()
 {
-    unique_ptr<State> initialState = get_initial_state();
-    unique_ptr<Node> root = build_action_nodes(NULL, *initialState);
-	root->parent = nullptr;
+    const size_t memoryBudget = treeBuildSettings->memoryBudget;
+    if (memoryBudget > 0)
+    {
+        TreeEstimate treeEstimate = estimate();
+        if (treeEstimate.get_working_set() > memoryBudget)
+        {
+            string message = "The tree needs " + to_string(treeEstimate.get_working_set() / (1024 * 1024))
+                + " MB, more than the budget of " + to_string(memoryBudget / (1024 * 1024)) + " MB.";
 
-    initialState.reset();
+            vector<string> drops;
+            if (get_bet_size_drops(memoryBudget, drops))
+            {
+                message += " It fits without";
+                for (size_t i = 0; i < drops.size(); i++)
+                    message += (i == 0 ? " " : ", ") + drops[i];
+                message += ".";
+            }
+            else
+            {
+                message += " It doesn't fit even without bet and raise sizes.";
+            }
+            throw runtime_error(message);
+        }
+    }
 
-    cout << "Flop action node count: " << flopActionNodeCount << "\n";
-    cout << "Turn action node count: " << turnActionNodeCount << "\n";
-    cout << "River action node count: " << riverActionNodeCount << "\n";
-    cout << "Chance node count: " << chanceNodeCount << "\n";
-    cout << "Uncontested node count: " << uncontestedNodeCount << "\n";
-	cout << "Allin node count: " << allinNodeCount << "\n";
-	cout << "Showdown node count: " << showdownNodeCount << "\n";
+    State initialState = get_initial_state();
+    root = build_action_nodes(initialState);
+
+    deal_chance_nodes();
+    treeBuildSettings->rangeManager->release_hand_evaluator();
+    update_subtree_cost(root, treeBuildSettings->initialBoard);
+    allocate_storage();
+
+    NodeCounts counts = nodeCounts.combine([](const NodeCounts& a, const NodeCounts& b) {
+        NodeCounts sum;
+        sum.flopActionNodes = a.flopActionNodes + b.flopActionNodes;
+        sum.turnActionNodes = a.turnActionNodes + b.turnActionNodes;
+        sum.riverActionNodes = a.riverActionNodes + b.riverActionNodes;
+        sum.chanceNodes = a.chanceNodes + b.chanceNodes;
+        sum.allinNodes = a.allinNodes + b.allinNodes;
+        sum.showdownNodes = a.showdownNodes + b.showdownNodes;
+        sum.uncontestedNodes = a.uncontestedNodes + b.uncontestedNodes;
+        return sum;
+    });
+    nodeCounts.clear();
+
+    cout << "Flop action node count: " << counts.flopActionNodes << "\n";
+    cout << "Turn action node count: " << counts.turnActionNodes << "\n";
+    cout << "River action node count: " << counts.riverActionNodes << "\n";
+    cout << "Chance node count: " << counts.chanceNodes << "\n";
+    cout << "Uncontested node count: " << counts.uncontestedNodes << "\n";
+	cout << "Allin node count: " << counts.allinNodes << "\n";
+	cout << "Showdown node count: " << counts.showdownNodes << "\n";
+    cout << "Tree structure: " << get_structure_size() / 1024 << " KB\n";
+    cout << "Regret/strategy storage: " << storage.size() / (1024 * 1024) << " MB\n";
 
     return root;
 }
 
-unique_ptr<State> GameTree::get_initial_state()
+// FNV-1a over the node arenas, field by field so padding never leaks in
+uint64_t GameTree::get_fingerprint()
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; i++)
+        {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    };
+
+    add(storage.size());
+    add((uint64_t) treeBuildSettings->storageType);
+    add(actionNodes.size());
+    for (ActionNode& actionNode : actionNodes)
+    {
+        add(actionNode.player);
+        add(actionNode.numHands);
+        add(actionNode.numActions);
+        add(actionNode.firstChild);
+        add(actionNode.actionNodeOffset);
+        add(actionNode.chanceNodeOffset);
+        add(actionNode.storageOffset);
+    }
+
+    add(children.size());
+    for (NodeRef& child : children)
+    {
+        add((uint64_t) child.kind);
+        add(child.index);
+    }
+
+    add(chanceNodeChildren.size());
+    for (ChanceNodeChild& child : chanceNodeChildren)
+    {
+        add(child.card);
+        add((uint64_t) child.node.kind);
+        add(child.node.index);
+        add(child.isomorphismCount);
+    }
+
+    return hash;
+}
+
+size_t GameTree::get_structure_size()
 {
-    unique_ptr<State> state = make_unique<State>();
+    return actionNodes.size() * sizeof(ActionNode) + chanceNodes.size() * sizeof(ChanceNode)
+        + terminalNodes.size() * sizeof(TerminalNode) + actions.size() * sizeof(Action)
+        + children.size() * sizeof(NodeRef) + chanceNodeChildren.size() * sizeof(ChanceNodeChild)
+        + isomorphisms.size();
+}
 
-    state->street = treeBuildSettings->initialStreet;
+void GameTree::allocate_storage()
+{
+    // blocks in node order, so every card's subtree is contiguous
+    size_t storageSize = 0;
+    for (ActionNode& actionNode : actionNodes)
+    {
+        actionNode.storageOffset = storageSize;
+        storageSize += actionNode.get_block_size(treeBuildSettings->storageType);
+    }
+
+    // One buffer for every regretSum/strategySum block, zeroed by ranges of
+    // nodes in parallel. A range's pages are first touched by the thread
+    // that zeroes it, which places them in that thread's memory the way the
+    // training tasks later tend to split the same subtrees.
+    storage.resize(storageSize);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, actionNodes.size()),
+        [&](const tbb::blocked_range<size_t>& range) {
+            size_t begin = actionNodes[range.begin()].storageOffset;
+            size_t end = range.end() < actionNodes.size() ? actionNodes[range.end()].storageOffset : storageSize;
+            std::memset(storage.data() + begin, 0, end - begin);
+
+            for (size_t i = range.begin(); i != range.end(); i++)
+                actionNodes[i].set_storage(&storage[actionNodes[i].storageOffset], treeBuildSettings->storageType);
+        });
+}
+
+State GameTree::get_initial_state()
+{
+    State state;
+
+    state.street = treeBuildSettings->initialStreet;
 		
-    state->potSize = treeBuildSettings->initialPotSize;
+    state.potSize = treeBuildSettings->initialPotSize;
     
-    state->minimumBetSize = treeBuildSettings->minimumBetSize;
-    state->minimumRaiseSize = treeBuildSettings->minimumBetSize;
+    state.minimumBetSize = treeBuildSettings->minimumBetSize;
+    state.minimumRaiseSize = treeBuildSettings->minimumBetSize;
     
-    unique_ptr<PlayerState> p1 = make_unique<PlayerState>(1, treeBuildSettings->inPositionPlayerId == 1, treeBuildSettings->startingStackSize);
-    unique_ptr<PlayerState> p2 = make_unique<PlayerState>(2, treeBuildSettings->inPositionPlayerId == 2, treeBuildSettings->startingStackSize);
-    
-    state->p1 = move(p1);
-    state->p2 = move(p2);
+    state.p1 = PlayerState(1, treeBuildSettings->inPositionPlayerId == 1, treeBuildSettings->startingStackSize);
+    state.p2 = PlayerState(2, treeBuildSettings->inPositionPlayerId == 2, treeBuildSettings->startingStackSize);
     
     for (int i = 0; i < 5; i++)
-        state->board[i] = treeBuildSettings->initialBoard[i];
+        state.board[i] = treeBuildSettings->initialBoard[i];
     
-    state->initialize_current();
-    state->initialize_lastToAct();
+    state.initialize_current();
+    state.initialize_lastToAct();
     
     return state;
 }
 
-unique_ptr<Node> GameTree::build_action_nodes(Node* parent, State& state)
+NodeRef GameTree::build_action_nodes(State& state)
 {
     int numHands = 0;
-	int p1NumHands = treeBuildSettings->rangeManager->get_num_hands(1, state.board);
-	int p2NumHands = treeBuildSettings->rangeManager->get_num_hands(2, state.board);
+	int boardIndex = RangeManager::get_board_index(state.board);
+	int p1NumHands = treeBuildSettings->rangeManager->get_num_hands(1, boardIndex);
+	int p2NumHands = treeBuildSettings->rangeManager->get_num_hands(2, boardIndex);
 
 	if (state.get_current_id() == 1)
 		numHands = p1NumHands;
 	else if (state.get_current_id() == 2)
 		numHands = p2NumHands;
 
-    unique_ptr<Node> actionNode = make_unique<ActionNode>(parent, state.get_current_id(), numHands);
-	actionNode->type = NodeType::ACTION;
+    NodeRef ref = { NodeKind::ACTION, (int)actionNodes.size() };
+    actionNodes.emplace_back(state.get_current_id(), numHands);
+	actionNodes[ref.index].type = NodeType::ACTION;
 
-    if (state.street == Street::FLOP)
-        flopActionNodeCount++;
-    else if (state.street == Street::TURN)
-        turnActionNodeCount++;
-    else if (state.street == Street::RIVER)
-        riverActionNodeCount++;
-    
-    vector<float> betSizes;
-    vector<float> raiseSizes;
+    nodeCounts.local().add_action_node(state.street);
     
+    int firstChild = actions.size();
+    add_actions(state, actions);
+
+    // reserve the edges up front so they stay contiguous while the subtrees
+    // below are being appended to the arenas
+    int numActions = actions.size() - firstChild;
+    children.resize(firstChild + numActions);
+
+    for (int i = 0; i < numActions; i++)
+    {
+        Action action = actions[firstChild + i];
+        children[firstChild + i] = build_action(state, action);
+    }
+
+    ActionNode& actionNode = actionNodes[ref.index];
+    actionNode.firstChild = firstChild;
+    actionNode.numActions = numActions;
+
+    return ref;
+}
+
+// The settings' vectors are read in place and the valid actions are appended
+// to actions, which build_action_nodes passes the edge arena as, so there is
+// no heap allocation per node.
+void GameTree::add_actions(State& state, vector<Action>& actions)
+{
+    const vector<float>* betSizes = nullptr;
+    const vector<float>* raiseSizes = nullptr;
     unique_ptr<BetSettings>* p1BetSettings = &treeBuildSettings->p1BetSettings;
     unique_ptr<BetSettings>* p2BetSettings = &treeBuildSettings->p2BetSettings;
     
@@ -157,39 +306,39 @@ unique_ptr<Node> GameTree::build_action_nodes(Node* parent, State& state)
     {
         if (state.get_current_id() == 1)
         {
-            betSizes = (*p1BetSettings)->flopBetSizes;
-            raiseSizes = (*p1BetSettings)->flopRaiseSizes;
+            betSizes = &(*p1BetSettings)->flopBetSizes;
+            raiseSizes = &(*p1BetSettings)->flopRaiseSizes;
         }
         else
         {
-            betSizes = (*p2BetSettings)->flopBetSizes;
-            raiseSizes = (*p2BetSettings)->flopRaiseSizes;
+            betSizes = &(*p2BetSettings)->flopBetSizes;
+            raiseSizes = &(*p2BetSettings)->flopRaiseSizes;
         }
     }
     else if (state.street == Street::TURN)
     {
         if (state.get_current_id() == 1)
         {
-            betSizes = (*p1BetSettings)->turnBetSizes;
-            raiseSizes = (*p1BetSettings)->turnRaiseSizes;
+            betSizes = &(*p1BetSettings)->turnBetSizes;
+            raiseSizes = &(*p1BetSettings)->turnRaiseSizes;
         }
         else
         {
-            betSizes = (*p2BetSettings)->turnBetSizes;
-            raiseSizes = (*p2BetSettings)->turnRaiseSizes;
+            betSizes = &(*p2BetSettings)->turnBetSizes;
+            raiseSizes = &(*p2BetSettings)->turnRaiseSizes;
         }
     }
     else if (state.street == Street::RIVER)
     {
         if (state.get_current_id() == 1)
         {
-            betSizes = (*p1BetSettings)->riverBetSizes;
-            raiseSizes = (*p1BetSettings)->riverRaiseSizes;
+            betSizes = &(*p1BetSettings)->riverBetSizes;
+            raiseSizes = &(*p1BetSettings)->riverRaiseSizes;
         }
         else
         {
-            betSizes = (*p2BetSettings)->riverBetSizes;
-            raiseSizes = (*p2BetSettings)->riverRaiseSizes;
+            betSizes = &(*p2BetSettings)->riverBetSizes;
+            raiseSizes = &(*p2BetSettings)->riverRaiseSizes;
         }
     }
     
@@ -197,22 +346,19 @@ unique_ptr<Node> GameTree::build_action_nodes(Node* parent, State& state)
     {
         if (actionType == ActionType::FOLD)
         {
-            unique_ptr<Action> action = make_unique<Action>(ActionType::FOLD, 0);
-            build_action(actionNode.get(), state, p1NumHands, p2NumHands, move(action));
+            add_action(state, actions, Action(ActionType::FOLD, 0));
         }
         else if (actionType == ActionType::CHECK)
         {
-            unique_ptr<Action> action = make_unique<Action>(ActionType::CHECK, 0);
-            build_action(actionNode.get(), state, p1NumHands, p2NumHands, move(action));
+            add_action(state, actions, Action(ActionType::CHECK, 0));
         }	
         else if (actionType == ActionType::CALL)
         {
-            unique_ptr<Action> action = make_unique<Action>(ActionType::CALL, state.get_call_amount());
-            build_action(actionNode.get(), state, p1NumHands, p2NumHands, move(action));
+            add_action(state, actions, Action(ActionType::CALL, state.get_call_amount()));
         }
         else if (actionType == ActionType::BET)
         {
-            for (auto it = begin(betSizes); it != end(betSizes); it++)
+            for (auto it = begin(*betSizes); it != end(*betSizes); it++)
             {
                 float betSize = *it;
 
@@ -221,20 +367,18 @@ unique_ptr<Node> GameTree::build_action_nodes(Node* parent, State& state)
                 if (((float) betAmount + state.get_current_wager()) / (state.get_current_stack() + state.get_current_wager()) >= treeBuildSettings->allinThreshold)
                 {
                     betAmount = state.get_current_stack();
-                    unique_ptr<Action> action = make_unique<Action>(ActionType::BET, betAmount);
-                    build_action(actionNode.get(), state, p1NumHands, p2NumHands, move(action));
+                    add_action(state, actions, Action(ActionType::BET, betAmount));
                     break;
                 }
                 else
                 {
-                    unique_ptr<Action> action = make_unique<Action>(ActionType::BET, betAmount);
-                    build_action(actionNode.get(), state, p1NumHands, p2NumHands, move(action));
+                    add_action(state, actions, Action(ActionType::BET, betAmount));
                 }	
             }
         }
         else if (actionType == ActionType::RAISE)
         {
-            for (auto it = begin(raiseSizes); it != end(raiseSizes); it++)
+            for (auto it = begin(*raiseSizes); it != end(*raiseSizes); it++)
             {
                 float raiseSize = *it;
 
@@ -243,124 +387,563 @@ unique_ptr<Node> GameTree::build_action_nodes(Node* parent, State& state)
                 if ((float) raiseAmount / (state.get_current_stack() + state.get_current_wager()) >= treeBuildSettings->allinThreshold)
                 {
                     raiseAmount = state.get_current_stack() + state.get_current_wager();
-                    unique_ptr<Action> action = make_unique<Action>(ActionType::RAISE, raiseAmount);
-                    build_action(actionNode.get(), state, p1NumHands, p2NumHands, move(action));
+                    add_action(state, actions, Action(ActionType::RAISE, raiseAmount));
                     break;
                 }
                 else
                 {
-                    unique_ptr<Action> action = make_unique<Action>(ActionType::RAISE, raiseAmount);
-                    build_action(actionNode.get(), state, p1NumHands, p2NumHands, move(action));
+                    add_action(state, actions, Action(ActionType::RAISE, raiseAmount));
                 }
             }
         }
     }
+}
 
-    static_cast<ActionNode*>(actionNode.get())->initialize_strategySum();
-	static_cast<ActionNode*>(actionNode.get())->initialize_regretSum();
-
-    return actionNode;
+void GameTree::add_action(State& state, vector<Action>& actions, Action action)
+{
+    if (Action::is_valid_action(action, state.get_current_stack(), state.get_current_wager(), state.get_call_amount(), state.minimumRaiseSize))
+        actions.push_back(action);
 }
 
-void GameTree::build_action(
-    Node* actionNode,
-    State& state,
-    int p1NumHands,
-    int p2NumHands,
-    unique_ptr<Action> action)
+NodeRef GameTree::build_action(State& state, Action& action)
 {
-    if (Action::is_valid_action(*action, state.get_current_stack(), state.get_current_wager(), state.get_call_amount(), state.minimumRaiseSize))
+    NodeRef child;
+    int player = state.get_current_id();
+    State nextState = state;
+    bool betsSettled = nextState.apply_player_action(action);
+    if (betsSettled)
     {
-        unique_ptr<Node> child = nullptr;
-        unique_ptr<State> nextState = make_unique<State>(state);
-        bool betsSettled = nextState->apply_player_action(*action);
-        if (betsSettled)
-        {
-            if (nextState->is_uncontested() || nextState->both_players_are_allin() || nextState->street == Street::RIVER)
-                child = build_terminal_nodes(actionNode, *nextState);
-            else
-                child = build_chance_nodes(actionNode, *nextState);
-        }
+        if (nextState.is_uncontested() || nextState.both_players_are_allin() || nextState.street == Street::RIVER)
+            child = build_terminal_nodes(nextState, player);
         else
-        {
-            child = build_action_nodes(actionNode, *nextState);
-        }
-        static_cast<ActionNode*>(actionNode)->add_child(move(child), move(action));
-        nextState.reset();
+            child = build_chance_nodes(nextState);
     }
+    else
+    {
+        child = build_action_nodes(nextState);
+    }
+    return child;
 }
 
-unique_ptr<Node> GameTree::build_chance_nodes(Node* parent, State& state)
+NodeRef GameTree::build_chance_nodes(State& state)
 {
-    unique_ptr<Node> node = nullptr;
-    
+    NodeRef ref = { NodeKind::CHANCE, (int)chanceNodes.size() };
+
     if (state.street == Street::FLOP)
-        node = make_unique<ChanceNode>(parent, ChanceNodeType::DEAL_TURN);
+        chanceNodes.emplace_back(ChanceNodeType::DEAL_TURN);
     else if (state.street == Street::TURN)
-        node = make_unique<ChanceNode>(parent, ChanceNodeType::DEAL_RIVER);
+        chanceNodes.emplace_back(ChanceNodeType::DEAL_RIVER);
 
-	node->type = NodeType::CHANCE;
+	chanceNodes[ref.index].Node::type = NodeType::CHANCE;
 
-    ChanceNode *chanceNode = static_cast<ChanceNode*>(node.get());
-    chanceNodeCount++;
-    
+    nodeCounts.local().chanceNodes++;
+
+    // its first card's subtree becomes the template for the other cards
+    ChanceNodeBuild& chanceNodeBuild = chanceNodeBuilds.emplace_back();
+    chanceNodeBuild.state = state;
+    chanceNodeBuild.templateIndex = ref.index;
+
+    return ref;
+}
+
+// Copies of a template get chance nodes after the template's own, so every
+// template is built before its first copy is dealt.
+void GameTree::deal_chance_nodes()
+{
+    for (int i = 0; i < (int)chanceNodes.size(); i++)
+        deal_chance_node(i);
+
+    chanceNodeBuilds.clear();
+}
+
+void GameTree::deal_chance_node(int index)
+{
+    State state = chanceNodeBuilds[index].state;
+    const int templateIndex = chanceNodeBuilds[index].templateIndex;
+
+    // Only the first card of each orbit under the suit symmetries gets a
+    // subtree, the rest are recorded as the permutation that reaches them.
+    vector<uint8_t> symmetries = get_suit_symmetries(state.board);
+    int boardIndex = RangeManager::get_board_index(state.board);
+    for (uint8_t symmetry : symmetries)
+        treeBuildSettings->rangeManager->initialize_suit_permutation(boardIndex, symmetry);
+
+    vector<uint8_t> cards;
+    bool dealt[52] = {};
+    int firstChild = chanceNodeChildren.size();
     for (uint8_t card = 0; card < 52; card++)
     {
-		if (overlap(card, state.board))
+		if (dealt[card] || overlap(card, state.board))
 			continue;
 
-        unique_ptr<State> nextState = make_unique<State>(state);
-        
+        dealt[card] = true;
+        cards.push_back(card);
+        ChanceNodeChild& child = chanceNodeChildren.emplace_back(NodeRef(), card);
+        child.firstIsomorphism = isomorphisms.size();
+
+        for (uint8_t symmetry : symmetries)
+        {
+            uint8_t isomorphicCard = permute_suits(card, symmetry);
+            if (dealt[isomorphicCard])
+                continue;
+
+            dealt[isomorphicCard] = true;
+            isomorphisms.push_back(symmetry);
+            child.isomorphismCount++;
+        }
+    }
+
+    ChanceNode& chanceNode = chanceNodes[index];
+    chanceNode.firstChild = firstChild;
+    chanceNode.childCount = cards.size();
+
+    // the ranges of the turn cards that get subtrees, the first time a flop
+    // chance node deals them
+    if (state.street == Street::FLOP)
+        treeBuildSettings->rangeManager->initialize_turns(cards);
+
+    auto get_next_state = [&](int i) {
+        State nextState = state;
+
         if (state.street == Street::FLOP)
-            nextState->board[3] = card;
+            nextState.board[3] = cards[i];
         else if (state.street == Street::TURN)
-            nextState->board[4] = card;
-        
-        nextState->go_to_next_street();
-        
-        unique_ptr<Node> actionNode = build_action_nodes(node.get(), *nextState);
-        chanceNode->add_child(move(actionNode), card);
+            nextState.board[4] = cards[i];
+
+        nextState.go_to_next_street();
+        return nextState;
+    };
+
+    // the first card of a template builds the subtree the others copy
+    int firstCopy = 0;
+    if (chanceNodeBuilds[templateIndex].root.index < 0)
+    {
+        State nextState = get_next_state(0);
+        int firstActionNode = actionNodes.size();
+        int firstChanceNode = chanceNodes.size();
+        NodeRef root = build_action_nodes(nextState);
+
+        ChanceNodeBuild& templateBuild = chanceNodeBuilds[templateIndex];
+        templateBuild.root = root;
+        templateBuild.firstChanceNode = firstChanceNode;
+        templateBuild.actionNodeCount = actionNodes.size() - firstActionNode;
+        templateBuild.chanceNodeCount = chanceNodes.size() - firstChanceNode;
+
+        chanceNodeChildren[firstChild].node = root;
+        firstCopy = 1;
     }
-    
-    return node;
+
+    // Every copy has as many nodes as the template, so each gets its range of
+    // the arenas up front and the cards are copied in parallel. A copy is
+    // laid out exactly as a serial build would have appended it.
+    const ChanceNodeBuild templateBuild = chanceNodeBuilds[templateIndex];
+    const int copyCount = cards.size() - firstCopy;
+    const int firstActionNode = actionNodes.size();
+    const int firstChanceNode = chanceNodes.size();
+
+    actionNodes.resize(firstActionNode + copyCount * templateBuild.actionNodeCount, ActionNode(0, 0));
+    chanceNodes.resize(firstChanceNode + copyCount * templateBuild.chanceNodeCount, ChanceNode(ChanceNodeType::DEAL_TURN));
+    chanceNodeBuilds.resize(chanceNodes.size());
+
+    tbb::parallel_for(0, copyCount, [&](int copy) {
+        int i = firstCopy + copy;
+        State nextState = get_next_state(i);
+        int actionNodeOffset = firstActionNode + copy * templateBuild.actionNodeCount - templateBuild.root.index;
+        int chanceNodeOffset = firstChanceNode + copy * templateBuild.chanceNodeCount - templateBuild.firstChanceNode;
+
+        chanceNodeChildren[firstChild + i].node =
+            instantiate_action_nodes(templateBuild.root, nextState, actionNodeOffset, chanceNodeOffset);
+    });
+}
+
+// Writes a copy of the template subtree's action and chance nodes for the
+// board of state into the slots its offsets select. Copies of distinct cards
+// write distinct slots and boards, so they may run concurrently.
+NodeRef GameTree::instantiate_action_nodes(NodeRef templateNode, State& state, int actionNodeOffset, int chanceNodeOffset)
+{
+    NodeRef ref = { NodeKind::ACTION, templateNode.index + actionNodeOffset };
+    ActionNode actionNode = actionNodes[templateNode.index];
+
+    int boardIndex = RangeManager::get_board_index(state.board);
+    actionNode.numHands = treeBuildSettings->rangeManager->get_num_hands(actionNode.player, boardIndex);
+    actionNode.actionNodeOffset = actionNodeOffset;
+    actionNode.chanceNodeOffset = chanceNodeOffset;
+    actionNodes[ref.index] = actionNode;
+
+    NodeCounts& counts = nodeCounts.local();
+    counts.add_action_node(state.street);
+
+    for (int i = 0; i < actionNode.numActions; i++)
+    {
+        NodeRef child = children[actionNode.firstChild + i];
+        State nextState = state;
+        nextState.apply_player_action(actions[actionNode.firstChild + i]);
+
+        if (child.kind == NodeKind::ACTION)
+        {
+            instantiate_action_nodes(child, nextState, actionNodeOffset, chanceNodeOffset);
+        }
+        else if (child.kind == NodeKind::CHANCE)
+        {
+            int index = child.index + chanceNodeOffset;
+            chanceNodes[index] = ChanceNode(chanceNodes[child.index].type);
+            chanceNodes[index].Node::type = NodeType::CHANCE;
+            counts.chanceNodes++;
+
+            // dealt like the template's chance node, from its template
+            ChanceNodeBuild& chanceNodeBuild = chanceNodeBuilds[index];
+            chanceNodeBuild.state = nextState;
+            chanceNodeBuild.templateIndex = chanceNodeBuilds[child.index].templateIndex;
+        }
+        else if (child.kind == NodeKind::ALLIN)
+        {
+            treeBuildSettings->rangeManager->initialize_allin_equity(nextState.board);
+        }
+    }
+
+    return ref;
+}
+
+// Terminal nodes are shared by the cards of a chance node and keep the cost
+// of the board they were built for.
+float GameTree::update_subtree_cost(NodeRef ref, uint8_t board[5])
+{
+    if (ref.kind == NodeKind::ACTION)
+    {
+        ActionNode& actionNode = actionNodes[ref.index];
+
+        // every action touches both ranges once on top of the work below it
+        float subtreeCost = actionNode.numActions * get_num_hands(board);
+        for (int i = 0; i < actionNode.numActions; i++)
+            subtreeCost += update_subtree_cost(get_child(actionNode, i), board);
+
+        actionNode.subtreeCost = subtreeCost;
+        return subtreeCost;
+    }
+
+    if (ref.kind == NodeKind::CHANCE)
+    {
+        ChanceNode& chanceNode = chanceNodes[ref.index];
+        ChanceNodeChild* chanceChildren = get_children(chanceNode);
+
+        float subtreeCost = 0;
+        for (int i = 0; i < chanceNode.childCount; i++)
+        {
+            uint8_t nextBoard[5] = { board[0], board[1], board[2], board[3], board[4] };
+            if (board[3] == 52)
+                nextBoard[3] = chanceChildren[i].card;
+            else
+                nextBoard[4] = chanceChildren[i].card;
+
+            // plus mapping the reach probs onto the new board and the results
+            // back for every isomorphic card
+            subtreeCost += update_subtree_cost(chanceChildren[i].node, nextBoard)
+                + get_num_hands(nextBoard) * (1 + chanceChildren[i].isomorphismCount);
+        }
+
+        chanceNode.subtreeCost = subtreeCost;
+        return subtreeCost;
+    }
+
+    return terminalNodes[ref.index].subtreeCost;
 }
 
-unique_ptr<Node> GameTree::build_terminal_nodes(Node* parent, State& state)
+// Suit permutations that map the initial board onto itself and fix every
+// card dealt after it. Applied to a hand and the remaining cards they leave
+// the game unchanged as long as both starting ranges are symmetric too.
+vector<uint8_t> GameTree::get_suit_symmetries(uint8_t board[5])
 {
-    unique_ptr<Node> node = nullptr;
+    vector<uint8_t> symmetries;
+    if (!treeBuildSettings->suitIsomorphism)
+        return symmetries;
+
+    uint8_t* initialBoard = treeBuildSettings->initialBoard;
+
+    for (int permutation = 1; permutation < SUIT_PERMUTATION_COUNT; permutation++)
+    {
+        if (!treeBuildSettings->rangeManager->is_suit_symmetry(permutation))
+            continue;
+
+        bool symmetric = true;
+        for (int i = 0; i < 5; i++)
+        {
+            if (board[i] == 52)
+                continue;
+
+            uint8_t card = permute_suits(board[i], permutation);
+            if (initialBoard[i] != 52 ? !overlap(card, initialBoard) : card != board[i])
+                symmetric = false;
+        }
+
+        if (symmetric)
+            symmetries.push_back(permutation);
+    }
+
+    return symmetries;
+}
+
+NodeRef GameTree::build_terminal_nodes(State& state, int lastToAct)
+{
+    NodeRef ref = { NodeKind::SHOWDOWN, (int)terminalNodes.size() };
     
 	if (state.both_players_are_allin() && state.street != Street::RIVER)
 	{
-		allinNodeCount++;
-		node = make_unique<TerminalNode>(parent, TerminalNodeType::ALLIN);
+		nodeCounts.local().allinNodes++;
+		ref.kind = NodeKind::ALLIN;
+		terminalNodes.emplace_back(TerminalNodeType::ALLIN);
+		treeBuildSettings->rangeManager->initialize_allin_equity(state.board);
 	}
 	else if (state.is_uncontested())
 	{
-		uncontestedNodeCount++;
-		node = make_unique<TerminalNode>(parent, TerminalNodeType::UNCONTESTED);
+		nodeCounts.local().uncontestedNodes++;
+		ref.kind = NodeKind::UNCONTESTED;
+		terminalNodes.emplace_back(TerminalNodeType::UNCONTESTED);
 	}
 	else
 	{
-		showdownNodeCount++;
-		node = make_unique<TerminalNode>(parent, TerminalNodeType::SHOWDOWN);
+		nodeCounts.local().showdownNodes++;
+		terminalNodes.emplace_back(TerminalNodeType::SHOWDOWN);
 	}
-        
-	node->type = NodeType::TERMINAL;
 
-    TerminalNode *terminalNode = static_cast<TerminalNode*>(node.get());
+    TerminalNode& terminalNode = terminalNodes[ref.index];
+        
+	terminalNode.Node::type = NodeType::TERMINAL;
     
-    terminalNode->value = state.potSize / 2.0f;
+    terminalNode.value = state.potSize / 2.0f;
     
-    for (int i = 0; i < 5; i++)
-        terminalNode->board[i] = state.board[i];
+    terminalNode.lastToAct = lastToAct;
+
+    // an allin is a product with the hand-vs-hand equity matrix
+    terminalNode.subtreeCost = get_num_hands(state.board);
+    if (ref.kind == NodeKind::ALLIN)
+        terminalNode.subtreeCost *= terminalNode.subtreeCost / 4;
     
-    Node* temp = parent;
-    while (!temp->type == NodeType::ACTION)
+    return ref;
+}
+
+float GameTree::get_num_hands(uint8_t board[5])
+{
+    int boardIndex = RangeManager::get_board_index(board);
+    return treeBuildSettings->rangeManager->get_num_hands(1, boardIndex) +
+        treeBuildSettings->rangeManager->get_num_hands(2, boardIndex);
+}
+
+TreeEstimate GameTree::estimate()
+{
+    TreeEstimate treeEstimate;
+    treeEstimate.allinBoards.assign(53 * 53, false);
+    vector<Action> actionStack;
+
+    State initialState = get_initial_state();
+    StreetShape shape;
+    estimate_street(initialState, shape, actionStack);
+    estimate_subtree(initialState, shape, true, treeEstimate, actionStack);
+
+    return treeEstimate;
+}
+
+// Walks the betting of state's street like build_action_nodes, without
+// creating nodes. The valid actions of every node on the path are kept on
+// actionStack.
+void GameTree::estimate_street(State& state, StreetShape& shape, vector<Action>& actionStack)
+{
+    int firstAction = actionStack.size();
+    add_actions(state, actionStack);
+    int numActions = actionStack.size() - firstAction;
+
+    size_t shapeIndex = numActions * 2 + state.get_current_id() - 1;
+    if (shape.actionNodes.size() <= shapeIndex)
+        shape.actionNodes.resize(shapeIndex + 1, 0);
+    shape.actionNodes[shapeIndex]++;
+    shape.edges += numActions;
+
+    for (int i = 0; i < numActions; i++)
     {
-        temp = temp->parent;
+        State nextState = state;
+        bool betsSettled = nextState.apply_player_action(actionStack[firstAction + i]);
+        if (!betsSettled)
+            estimate_street(nextState, shape, actionStack);
+        else if (!nextState.is_uncontested() && !nextState.both_players_are_allin() && nextState.street != Street::RIVER)
+            shape.chanceStates.push_back(nextState);
+        else if (nextState.both_players_are_allin() && nextState.street != Street::RIVER)
+            shape.allinNodes++;
+        else if (nextState.is_uncontested())
+            shape.uncontestedNodes++;
+        else
+            shape.showdownNodes++;
     }
-    
-    terminalNode->lastToAct = static_cast<ActionNode*>(temp)->player;
-    
-    return node;
-}
\ No newline at end of file
+
+    actionStack.erase(actionStack.begin() + firstAction, actionStack.end());
+}
+
+// Adds the subtree from the start of state's street, whose betting is shape.
+// Edges and terminal nodes only exist in template subtrees, the ones
+// build_action_nodes builds.
+void GameTree::estimate_subtree(State& state, StreetShape& shape, bool isTemplate, TreeEstimate& treeEstimate, vector<Action>& actionStack)
+{
+    RangeManager* rangeManager = treeBuildSettings->rangeManager.get();
+    int boardIndex = RangeManager::get_board_index(state.board);
+    size_t actionNodeCount = 0;
+
+    for (size_t i = 0; i < shape.actionNodes.size(); i++)
+    {
+        if (shape.actionNodes[i] == 0)
+            continue;
+
+        int player = i % 2 + 1;
+        ActionNode actionNode(player, rangeManager->get_num_hands(player, boardIndex));
+        actionNode.numActions = i / 2;
+        treeEstimate.storageBytes += shape.actionNodes[i] * actionNode.get_block_size(treeBuildSettings->storageType);
+        actionNodeCount += shape.actionNodes[i];
+    }
+
+    if (state.street == Street::FLOP)
+        treeEstimate.flopActionNodes += actionNodeCount;
+    else if (state.street == Street::TURN)
+        treeEstimate.turnActionNodes += actionNodeCount;
+    else if (state.street == Street::RIVER)
+        treeEstimate.riverActionNodes += actionNodeCount;
+    treeEstimate.structureBytes += actionNodeCount * sizeof(ActionNode);
+
+    // one equity table per board, int8 on the turn and int16 on the flop
+    if (shape.allinNodes > 0 && !treeEstimate.allinBoards[boardIndex])
+    {
+        treeEstimate.allinBoards[boardIndex] = true;
+        treeEstimate.allinEquityBytes += (size_t)rangeManager->get_num_hands(1, boardIndex)
+            * rangeManager->get_num_hands(2, boardIndex) * (state.street == Street::FLOP ? 2 : 1);
+    }
+
+    if (isTemplate)
+    {
+        treeEstimate.allinNodes += shape.allinNodes;
+        treeEstimate.showdownNodes += shape.showdownNodes;
+        treeEstimate.uncontestedNodes += shape.uncontestedNodes;
+        treeEstimate.structureBytes += shape.edges * (sizeof(Action) + sizeof(NodeRef))
+            + (shape.allinNodes + shape.showdownNodes + shape.uncontestedNodes) * sizeof(TerminalNode);
+    }
+
+    // the chance nodes of this card's copy of the street
+    for (State chanceState : shape.chanceStates)
+    {
+        for (int i = 0; i < 5; i++)
+            chanceState.board[i] = state.board[i];
+        estimate_chance_node(chanceState, isTemplate, treeEstimate, actionStack);
+    }
+}
+
+// Deals the cards like deal_chance_node. The betting after every card is the
+// same, so it is walked once for the first card. Only the first card of a
+// template chance node builds a template subtree.
+void GameTree::estimate_chance_node(State& state, bool isTemplate, TreeEstimate& treeEstimate, vector<Action>& actionStack)
+{
+    treeEstimate.chanceNodes++;
+    treeEstimate.structureBytes += sizeof(ChanceNode);
+
+    vector<uint8_t> symmetries = get_suit_symmetries(state.board);
+
+    StreetShape shape;
+    bool dealt[52] = {};
+    bool first = true;
+    for (uint8_t card = 0; card < 52; card++)
+    {
+        if (dealt[card] || overlap(card, state.board))
+            continue;
+
+        dealt[card] = true;
+        treeEstimate.structureBytes += sizeof(ChanceNodeChild);
+
+        for (uint8_t symmetry : symmetries)
+        {
+            uint8_t isomorphicCard = permute_suits(card, symmetry);
+            if (dealt[isomorphicCard])
+                continue;
+
+            dealt[isomorphicCard] = true;
+            treeEstimate.structureBytes += sizeof(uint8_t);
+        }
+
+        State nextState = state;
+        if (state.street == Street::FLOP)
+            nextState.board[3] = card;
+        else if (state.street == Street::TURN)
+            nextState.board[4] = card;
+        nextState.go_to_next_street();
+
+        if (first)
+            estimate_street(nextState, shape, actionStack);
+
+        estimate_subtree(nextState, shape, isTemplate && first, treeEstimate, actionStack);
+        first = false;
+    }
+}
+
+bool GameTree::get_bet_size_drops(size_t memoryBudget, vector<string>& drops)
+{
+    class BetSizes
+    {
+        public:
+            string name;
+            vector<float>* sizes;
+    };
+
+    vector<BetSizes> candidates;
+    for (int player = 1; player <= 2; player++)
+    {
+        BetSettings* betSettings = (player == 1) ? treeBuildSettings->p1BetSettings.get() : treeBuildSettings->p2BetSettings.get();
+        string prefix = "p" + to_string(player) + " ";
+        candidates.push_back({ prefix + "flop bet", &betSettings->flopBetSizes });
+        candidates.push_back({ prefix + "flop raise", &betSettings->flopRaiseSizes });
+        candidates.push_back({ prefix + "turn bet", &betSettings->turnBetSizes });
+        candidates.push_back({ prefix + "turn raise", &betSettings->turnRaiseSizes });
+        candidates.push_back({ prefix + "river bet", &betSettings->riverBetSizes });
+        candidates.push_back({ prefix + "river raise", &betSettings->riverRaiseSizes });
+    }
+
+    vector<vector<float>> original;
+    for (BetSizes& candidate : candidates)
+        original.push_back(*candidate.sizes);
+
+    drops.clear();
+    size_t workingSet = estimate().get_working_set();
+    while (workingSet > memoryBudget)
+    {
+        // the size whose removal leaves the smallest tree
+        int bestCandidate = -1;
+        int bestSize = -1;
+        size_t bestWorkingSet = workingSet;
+
+        for (int i = 0; i < (int)candidates.size(); i++)
+        {
+            vector<float>& sizes = *candidates[i].sizes;
+            for (int j = 0; j < (int)sizes.size(); j++)
+            {
+                float size = sizes[j];
+                sizes.erase(sizes.begin() + j);
+                size_t candidateWorkingSet = estimate().get_working_set();
+                sizes.insert(sizes.begin() + j, size);
+
+                if (candidateWorkingSet < bestWorkingSet)
+                {
+                    bestCandidate = i;
+                    bestSize = j;
+                    bestWorkingSet = candidateWorkingSet;
+                }
+            }
+        }
+
+        if (bestCandidate < 0)
+            break;
+
+        vector<float>& sizes = *candidates[bestCandidate].sizes;
+        ostringstream drop;
+        drop << candidates[bestCandidate].name << " " << sizes[bestSize];
+        drops.push_back(drop.str());
+        sizes.erase(sizes.begin() + bestSize);
+        workingSet = bestWorkingSet;
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++)
+        *candidates[i].sizes = original[i];
+
+    return workingSet <= memoryBudget;
+}
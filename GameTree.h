@@ -5,33 +5,207 @@
 #include "State.h"
 #include "Action.h"
 #include "Node.h"
+#include "NodeRef.h"
 #include "ActionNode.h"
 #include "ChanceNode.h"
+#include "ChanceNodeChild.h"
 #include "TerminalNode.h"
+#include "TreeEstimate.h"
 #include <vector>
 #include <memory>
+#include <string>
+#include <utility>
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/enumerable_thread_specific.h>
 using std::unique_ptr;
 using std::vector;
+using std::string;
 
+// A cache_aligned_allocator that leaves new elements uninitialized, so the
+// pages of GameTree::storage are first touched by the threads that zero
+// them instead of by resize().
+template <typename T>
+class UninitializedAllocator : public tbb::cache_aligned_allocator<T>
+{
+    public:
+        template <typename U>
+        struct rebind
+        {
+            typedef UninitializedAllocator<U> other;
+        };
+
+        UninitializedAllocator() = default;
+
+        template <typename U>
+        UninitializedAllocator(const UninitializedAllocator<U>&) {}
+
+        template <typename U>
+        void construct(U* p)
+        {
+            ::new ((void*)p) U;
+        }
+
+        template <typename U, typename... Args>
+        void construct(U* p, Args&&... args)
+        {
+            ::new ((void*)p) U(std::forward<Args>(args)...);
+        }
+};
+
+// The tree lives in typed arenas instead of a pointer tree. Nodes reference
+// their children by NodeRef, the edges of an action node are contiguous in
+// actions/children and the children of a chance node are contiguous in
+// chanceNodeChildren. All regretSum/strategySum blocks are carved out of the
+// single storage buffer once the shape of the tree is known, in the element
+// type TreeBuildSettings::storageType selects.
+//
+// The betting below a chance node is the same for every card it deals, so
+// its edges and terminal nodes are only built for the first card. The other
+// cards get copies of the first card's action and chance nodes, which hold
+// the per board data (hand counts and storage blocks), laid out in the same
+// order. A copy's edges are the template's edges shifted by the copy's
+// offsets, which get_child applies.
+//
+// A copy has as many nodes as its template, so the cards of a chance node
+// get their ranges of the arenas up front and are copied in parallel.
 class GameTree {
     private:
-        unique_ptr<State> get_initial_state();
-        void build_action(
-            Node* actionNode,
-            State& state,
-            int p1NumHands,
-            int p2NumHands,
-            unique_ptr<Action> action);
-        unique_ptr<Node> build_action_nodes(Node* parent, State& state);
-        unique_ptr<Node> build_chance_nodes(Node* parent, State& state);
-        unique_ptr<Node> build_terminal_nodes(Node* parent, State& state);
+        // Chance nodes are dealt in index order once the betting of their
+        // street is built, so the records of one card's subtree stay
+        // contiguous. Until then they keep their State here, and the chance
+        // node whose first card's subtree is the template for their cards.
+        // Templates record their root and size once that card is built.
+        class ChanceNodeBuild
+        {
+            public:
+                State state;
+                int templateIndex = 0;
+                NodeRef root = { NodeKind::ACTION, -1 };
+                int firstChanceNode = 0;
+                int actionNodeCount = 0;
+                int chanceNodeCount = 0;
+        };
+        vector<ChanceNodeBuild> chanceNodeBuilds;
+
+        // Nodes built, counted per thread and summed by build()
+        class NodeCounts
+        {
+            public:
+                int flopActionNodes = 0;
+                int turnActionNodes = 0;
+                int riverActionNodes = 0;
+                int chanceNodes = 0;
+                int allinNodes = 0;
+                int showdownNodes = 0;
+                int uncontestedNodes = 0;
+
+                void add_action_node(Street street);
+        };
+        tbb::enumerable_thread_specific<NodeCounts> nodeCounts;
+
+        // The betting of one street, which is the same for every card dealt
+        // before it. Action nodes are counted per player and number of
+        // actions, at index numActions * 2 + player - 1.
+        class StreetShape
+        {
+            public:
+                vector<size_t> actionNodes;
+                int edges = 0;
+                int allinNodes = 0;
+                int showdownNodes = 0;
+                int uncontestedNodes = 0;
+                vector<State> chanceStates;
+        };
+
+        State get_initial_state();
+        void add_actions(State& state, vector<Action>& actions);
+        void add_action(State& state, vector<Action>& actions, Action action);
+        NodeRef build_action(State& state, Action& action);
+        NodeRef build_action_nodes(State& state);
+        NodeRef build_chance_nodes(State& state);
+        NodeRef build_terminal_nodes(State& state, int lastToAct);
+        NodeRef instantiate_action_nodes(NodeRef templateNode, State& state, int actionNodeOffset, int chanceNodeOffset);
+        void deal_chance_nodes();
+        void deal_chance_node(int index);
+        float update_subtree_cost(NodeRef node, uint8_t board[5]);
+        void allocate_storage();
+        float get_num_hands(uint8_t board[5]);
+        vector<uint8_t> get_suit_symmetries(uint8_t board[5]);
+        void estimate_street(State& state, StreetShape& shape, vector<Action>& actionStack);
+        void estimate_subtree(State& state, StreetShape& shape, bool isTemplate, TreeEstimate& estimate, vector<Action>& actionStack);
+        void estimate_chance_node(State& state, bool isTemplate, TreeEstimate& estimate, vector<Action>& actionStack);
     
     public:
         unique_ptr<TreeBuildSettings> treeBuildSettings;
-        
-        void print_tree(Node* root, int tabCount);
+
+        vector<ActionNode> actionNodes;
+        vector<ChanceNode> chanceNodes;
+        vector<TerminalNode> terminalNodes;
+        vector<Action> actions;
+        vector<NodeRef> children;
+        vector<ChanceNodeChild> chanceNodeChildren;
+        vector<uint8_t> isomorphisms;
+        vector<uint8_t, UninitializedAllocator<uint8_t>> storage;
+        NodeRef root;
+
         GameTree(unique_ptr<TreeBuildSettings> treeBuildSettings);
-        unique_ptr<Node> build();
+
+        // Throws std::runtime_error without building anything if the
+        // estimate exceeds TreeBuildSettings::memoryBudget.
+        NodeRef build();
+
+        // Counts what build would allocate by walking the betting of each
+        // street once per chance node instead of once per card, without
+        // memory proportional to the tree.
+        TreeEstimate estimate();
+
+        // Bet and raise sizes to remove from the settings, greedily the one
+        // that saves the most memory first, until the estimate fits in
+        // memoryBudget. Returns false if removing every size doesn't fit.
+        // The settings are left unchanged.
+        bool get_bet_size_drops(size_t memoryBudget, vector<string>& drops);
+        void print_tree(NodeRef node, int tabCount);
+
+        // Hash of everything that decides where a node's regretSum and
+        // strategySum live in storage. Stored in checkpoints.
+        uint64_t get_fingerprint();
+
+        // bytes of the node records and edges, without storage
+        size_t get_structure_size();
+
+        inline NodeRef get_child(ActionNode& node, int action)
+        {
+            NodeRef child = children[node.firstChild + action];
+            if (child.kind == NodeKind::ACTION)
+                child.index += node.actionNodeOffset;
+            else if (child.kind == NodeKind::CHANCE)
+                child.index += node.chanceNodeOffset;
+            return child;
+        }
+
+        inline Action& get_action(ActionNode& node, int action)
+        {
+            return actions[node.firstChild + action];
+        }
+
+        inline ChanceNodeChild* get_children(ChanceNode& node)
+        {
+            return &chanceNodeChildren[node.firstChild];
+        }
+
+        inline uint8_t* get_isomorphisms(ChanceNodeChild& child)
+        {
+            return isomorphisms.data() + child.firstIsomorphism;
+        }
+
+        inline float get_subtree_cost(NodeRef node)
+        {
+            if (node.kind == NodeKind::ACTION)
+                return actionNodes[node.index].subtreeCost;
+            else if (node.kind == NodeKind::CHANCE)
+                return chanceNodes[node.index].subtreeCost;
+            return terminalNodes[node.index].subtreeCost;
+        }
 };
 
-#endif
\ No newline at end of file
+#endif
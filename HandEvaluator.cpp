@@ -2,25 +2,81 @@
 #include <cstring>
 #include <stdio.h>
 #include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 using std::memset;
 using std::cout;
+using std::runtime_error;
 
-HandEvaluator* HandEvaluator::instance = 0;
+string HandEvaluator::path = "HandRanks.dat";
+bool HandEvaluator::populate = false;
+weak_ptr<HandEvaluator> HandEvaluator::instance;
+std::mutex HandEvaluator::instanceMutex;
 
 HandEvaluator::HandEvaluator()
 {
-    memset(HR, 0, sizeof(HR));
-    FILE* fin = fopen("HandRanks.dat", "rb");
-    size_t bytesread = fread(HR, sizeof(HR), 1, fin);
-    fclose(fin);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Could not open " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < HR_SIZE * sizeof(int))
+    {
+        close(fd);
+        throw runtime_error(path + " is not a complete HandRanks.dat");
+    }
+
+    mappedBytes = HR_SIZE * sizeof(int);
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (populate)
+        flags |= MAP_POPULATE;
+#endif
+    void* table = mmap(nullptr, mappedBytes, PROT_READ, flags, fd, 0);
+    close(fd);
+
+    if (table == MAP_FAILED)
+        throw runtime_error("Could not map " + path);
+
+#ifdef MADV_HUGEPAGE
+    // only a hint, ignored unless the kernel backs file mappings with huge pages
+    madvise(table, mappedBytes, MADV_HUGEPAGE);
+#endif
+
+    HR = (const int*) table;
 	//test();
 }
 
-HandEvaluator* HandEvaluator::get_instance()
+HandEvaluator::~HandEvaluator()
+{
+    munmap((void*) HR, mappedBytes);
+}
+
+shared_ptr<HandEvaluator> HandEvaluator::get_instance()
+{
+	std::lock_guard<std::mutex> lock(instanceMutex);
+	shared_ptr<HandEvaluator> evaluator = instance.lock();
+	if (!evaluator)
+	{
+		evaluator = shared_ptr<HandEvaluator>(new HandEvaluator());
+		instance = evaluator;
+	}
+	return evaluator;
+}
+
+void HandEvaluator::set_path(string path)
+{
+	std::lock_guard<std::mutex> lock(instanceMutex);
+	HandEvaluator::path = path;
+}
+
+void HandEvaluator::set_populate(bool populate)
 {
-	if (!instance)
-		instance = new HandEvaluator();
-	return instance;
+	std::lock_guard<std::mutex> lock(instanceMutex);
+	HandEvaluator::populate = populate;
 }
 
 int HandEvaluator::get_hand_rank(uint8_t holeCard1, uint8_t holeCard2, uint8_t board[5])
@@ -34,6 +90,21 @@ int HandEvaluator::get_hand_rank(uint8_t holeCard1, uint8_t holeCard2, uint8_t b
 	return HR[p + board[4] + 1];
 }
 
+int HandEvaluator::get_board_state(uint8_t board[5])
+{
+	int boardState = 53;
+	for (int i = 0; i < 5; i++)
+		if (board[i] != 52)
+			boardState = add_card(boardState, board[i]);
+	return boardState;
+}
+
+void HandEvaluator::set_hand_ranks(int boardState, Hand* hands, int numHands)
+{
+	for (int i = 0; i < numHands; i++)
+		hands[i].rank = HR[HR[boardState + hands[i].card1 + 1] + hands[i].card2 + 1];
+}
+
 void HandEvaluator::test()
 {
     // Now let's enumerate every possible 7-card poker hand
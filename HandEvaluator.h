@@ -2,19 +2,59 @@
 #define HAND_EVALUATOR_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include "Hand.h"
+#include <memory>
+#include <mutex>
+#include <string>
+using std::shared_ptr;
+using std::weak_ptr;
+using std::string;
 
+// TwoPlusTwo 7-card lookup table, mapped read-only from HandRanks.dat so
+// every process on the box shares the page cache copy. The mapping lives as
+// long as some caller holds the shared_ptr returned by get_instance().
 class HandEvaluator
 {
     private:
-        int HR[32487834];
-        static HandEvaluator* instance;
+        static const size_t HR_SIZE = 32487834;
+
+        const int* HR = nullptr;
+        size_t mappedBytes = 0;
+
+        static string path;
+        static bool populate;
+        static weak_ptr<HandEvaluator> instance;
+        static std::mutex instanceMutex;
+
         HandEvaluator();
 
     public:
+        ~HandEvaluator();
+        HandEvaluator(const HandEvaluator&) = delete;
+        HandEvaluator& operator=(const HandEvaluator&) = delete;
+
         int get_hand_rank(uint8_t holeCard1, uint8_t holeCard2, uint8_t board[5]);
+
+        // The table walk is independent of card order, so the board can be
+        // walked once and shared by every hand ranked against it. A board
+        // state is extended one card at a time (flop, then turn, then river)
+        // and a complete 5 card board state ranks a batch of hands with two
+        // lookups each.
+        int get_board_state(uint8_t board[5]);
+        inline int add_card(int boardState, uint8_t card)
+        {
+            return HR[boardState + card + 1];
+        }
+        void set_hand_ranks(int boardState, Hand* hands, int numHands);
         void test();
-        static HandEvaluator* get_instance();
+        static shared_ptr<HandEvaluator> get_instance();
+
+        // Location of HandRanks.dat (the working directory by default) and
+        // whether to fault the whole table in when it is mapped. Takes effect
+        // the next time the table is mapped.
+        static void set_path(string path);
+        static void set_populate(bool populate);
 };
 
 #endif
-
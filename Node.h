@@ -2,14 +2,17 @@
 #define NODE_H
 
 #include "NodeTypeEnum.h"
-#include <memory>
-using std::unique_ptr;
 
+// Nodes are plain records stored by value in the GameTree arenas and are
+// never accessed polymorphically, so there is no vtable.
 class Node {
     public:
 		NodeType type;
-        Node* parent;
-        virtual ~Node() = default;
+
+		// Estimated work of one traversal of the subtree rooted here, in
+		// hand visits. Filled in by GameTree::build and used to decide when
+		// spawning tasks is worth it.
+		float subtreeCost = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
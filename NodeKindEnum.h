@@ -0,0 +1,17 @@
+#ifndef NODE_KIND_ENUM_H
+#define NODE_KIND_ENUM_H
+
+#include <stdint.h>
+
+// NodeType refined by the terminal subtype. It is stored in every NodeRef so
+// a traversal can select the handler for a child without loading the node.
+enum class NodeKind : uint8_t
+{
+	ACTION,
+	CHANCE,
+	ALLIN,
+	UNCONTESTED,
+	SHOWDOWN
+};
+
+#endif
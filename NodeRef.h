@@ -0,0 +1,15 @@
+#ifndef NODE_REF_H
+#define NODE_REF_H
+
+#include "NodeKindEnum.h"
+
+// Location of a node inside the GameTree arenas. The kind selects the arena
+// (actionNodes, chanceNodes or terminalNodes) and index is the slot in it.
+class NodeRef
+{
+    public:
+        NodeKind kind;
+        int index;
+};
+
+#endif
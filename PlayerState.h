@@ -1,25 +1,23 @@
 #ifndef PLAYER_STATE_H
 #define PLAYER_STATE_H
 
-#include <memory>
-using std::unique_ptr;
-
+// Plain value, copied along with State
 class PlayerState
 {
     public:
-        bool hasPosition;
-        bool hasFolded;
-        int stackSize;
-        int chipsCommitted;
-        int wager;
-        int id;
+        bool hasPosition = false;
+        bool hasFolded = false;
+        int stackSize = 0;
+        int chipsCommitted = 0;
+        int wager = 0;
+        int id = 0;
 
+        PlayerState() = default;
         PlayerState(int id, bool hasPosition, int stackSize);
-        PlayerState(PlayerState& playerState);
         bool is_allin();
         void commit_chips(int amount);
         void uncommit_chips(int amount);
         void reset_wager();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,23 +1,41 @@
 #include "RangeManager.h"
 #include <algorithm>
+#include <numeric>
 #include <sstream>
 #include <iostream>
+#include <stdexcept>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/task_arena.h>
 using std::cout;
 using std::istringstream;
 using std::stof;
 using std::move;
 using std::sort;
+using std::stable_sort;
+using std::iota;
+using std::min;
+using std::max;
 
 RangeManager::RangeManager(string p1StartingHands, string p2StartingHands, uint8_t initialBoard[5])
 {
     handEvaluator = HandEvaluator::get_instance();
+	for (int i = 0; i < 5; i++)
+		this->initialBoard[i] = initialBoard[i];
+	allinEquities.resize(BOARD_INDEX_COUNT);
+	p1SuitPermutations.resize(53 * SUIT_PERMUTATION_COUNT);
+	p2SuitPermutations.resize(53 * SUIT_PERMUTATION_COUNT);
 	initialize_starting_range(1, p1StartingHands, initialBoard);
 	initialize_starting_range(2, p2StartingHands, initialBoard);
-	initialize_ranges(1, initialBoard);
-	initialize_ranges(2, initialBoard);
-	free(handEvaluator);
-	initialize_reach_probs_mapping(1, initialBoard);
-	initialize_reach_probs_mapping(2, initialBoard);
+	initialize_suit_symmetries();
+	tbb::parallel_invoke([&] { initialize_offsets(1); }, [&] { initialize_offsets(2); });
+
+	if (board_has_turn(initialBoard) && !board_has_river(initialBoard))
+		initialize_turn(initialBoard[3]);
+
+	// a flop spot's turn cards are built with its tree
+	if (board_has_turn(initialBoard))
+		handEvaluator.reset();
 }
 
 void RangeManager::initialize_starting_range(int player, string startingHands, uint8_t initialBoard[5])
@@ -123,221 +141,219 @@ void RangeManager::initialize_starting_range(int player, string startingHands, u
 	}
 
 	if (player == 1)
-	{
 		p1StartingHands = hands;
-		p1Ranges[get_key(initialBoard)] = hands;
-	}
 	else
-	{
 		p2StartingHands = hands;
-		p2Ranges[get_key(initialBoard)] = hands;
-	}
 }
 
-void RangeManager::initialize_reach_probs_mapping(int player, uint8_t initialBoard[5])
+// Sizes every reachable board's range and fills in the initial board's, which
+// is the starting range.
+void RangeManager::initialize_offsets(int player)
 {
 	vector<Hand>& startingHands = get_starting_hands(player);
-	unordered_map<int, vector<Hand>>& ranges = get_ranges(player);
-	unordered_map<int, vector<int>>& reachProbsMapping = get_reach_probs_mappings(player);
-
-	if (!board_has_turn(initialBoard))
+	vector<Hand>& hands = (player == 1) ? p1Hands : p2Hands;
+	vector<int>& reachProbsMapping = (player == 1) ? p1ReachProbsMapping : p2ReachProbsMapping;
+	vector<int>& offsets = (player == 1) ? p1Offsets : p2Offsets;
+
+	// hands holding each card, and each pair of cards
+	int cardCounts[52] = {};
+	vector<int> pairCounts(52 * 52, 0);
+	for (Hand& hand : startingHands)
 	{
-		for (uint8_t turn = 0; turn < 52; turn++)
-		{
-			if (overlap(turn, initialBoard))
-				continue;
-			
-			uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, 52 };
-			int key = get_key(board);
-
-			vector<Hand>& turnHands = ranges[key];
-			vector<int> reachProbs = vector<int>(turnHands.size());
-
-			int j = 0;
-			for (int i = 0; i < turnHands.size(); i++)
-			{
-				while (!equals(turnHands[i], startingHands[j]))
-					j++;
-
-				reachProbs[i] = j;
-			}
-
-			reachProbsMapping[key] = reachProbs;
-			
-			for (uint8_t river = 0; river < 52; river++)
-			{
-				if (turn == river || overlap(river, initialBoard))
-					continue;
-
-				uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, river };
-				int key = get_key(board);
+		cardCounts[hand.card1]++;
+		cardCounts[hand.card2]++;
+		pairCounts[hand.card1 * 52 + hand.card2]++;
+		pairCounts[hand.card2 * 52 + hand.card1]++;
+	}
 
-				vector<Hand>& riverHands = ranges[key];
-				vector<int> reachProbs = vector<int>(riverHands.size());
+	vector<int> sizes(BOARD_INDEX_COUNT, 0);
+	const int numHands = startingHands.size();
+	sizes[get_board_index(initialBoard)] = numHands;
 
-				int j = 0;
-				for (int i = 0; i < riverHands.size(); i++)
-				{
-					while (!equals(riverHands[i], turnHands[j]))
-						j++;
+	for (uint8_t turn = 0; turn < 52; turn++)
+	{
+		if (board_has_turn(initialBoard) ? turn != initialBoard[3] : overlap(turn, initialBoard))
+			continue;
 
-					reachProbs[i] = j;
-				}
+		uint8_t turnBoard[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, 52 };
+		if (!board_has_turn(initialBoard))
+			sizes[get_board_index(turnBoard)] = numHands - cardCounts[turn];
 
-				quickSort(riverHands, reachProbs, 0, riverHands.size()-1);
+		if (board_has_river(initialBoard))
+			continue;
 
-				reachProbsMapping[key] = reachProbs;
-			}
-		}
-	}
-	else if (!board_has_river(initialBoard))
-	{
 		for (uint8_t river = 0; river < 52; river++)
 		{
-			if (overlap(river, initialBoard))
+			if (river == turn || overlap(river, initialBoard))
 				continue;
 
-			uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], initialBoard[3], river };
-			int key = get_key(board);
-
-			vector<Hand>& riverHands = ranges[key];
-			vector<int> reachProbs = vector<int>(riverHands.size());
-
-			int j = 0;
-			for (int i = 0; i < riverHands.size(); i++)
-			{
-				while (!equals(riverHands[i], startingHands[j]))
-					j++;
-
-				reachProbs[i] = j;
-			}
-
-			quickSort(riverHands, reachProbs, 0, riverHands.size()-1);
-
-			reachProbsMapping[key] = reachProbs;
+			turnBoard[4] = river;
+			sizes[get_board_index(turnBoard)] = numHands - cardCounts[turn] - cardCounts[river] + pairCounts[turn * 52 + river];
 		}
 	}
+
+	offsets.resize(BOARD_INDEX_COUNT + 1);
+	offsets[0] = 0;
+	for (int i = 0; i < BOARD_INDEX_COUNT; i++)
+		offsets[i + 1] = offsets[i] + sizes[i];
+
+	hands.assign(offsets[BOARD_INDEX_COUNT], Hand(0, 0));
+	// the initial board has no mapping
+	reachProbsMapping.assign(offsets[BOARD_INDEX_COUNT], 0);
+	std::copy(begin(startingHands), end(startingHands), begin(hands) + offsets[get_board_index(initialBoard)]);
 }
 
-void RangeManager::initialize_ranges(int player, uint8_t initialBoard[5])
+void RangeManager::initialize_turns(const vector<uint8_t>& turns)
 {
-	vector<Hand>& startingHands = get_starting_hands(player);
-	unordered_map<int, vector<Hand>>& ranges = get_ranges(player);
-
-	if (!board_has_turn(initialBoard))
-	{
-		for (uint8_t turn = 0; turn < 52; turn++)
+	// one evaluator for the whole batch, only acquired when a card is missing
+	shared_ptr<HandEvaluator> evaluator;
+	for (uint8_t turn : turns)
+		if (!turnsBuilt[turn])
 		{
-			if (overlap(turn, initialBoard))
-				continue;
-
-			uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, 52 };
-			int key = get_key(board);
-			vector<Hand> turnHands;
+			evaluator = acquire_hand_evaluator();
+			break;
+		}
 
-			for (Hand hand : startingHands)
-			{
-				if (overlap(hand, turn))
-					continue;
+	tbb::parallel_for(size_t(0), turns.size(), [&](size_t i) {
+		initialize_turn(turns[i]);
+	});
+}
 
-				Hand newHand = Hand(hand.card1, hand.card2);
-				newHand.probability = hand.probability;
-				turnHands.push_back(newHand);
-			}
-			ranges[key] = turnHands;
+void RangeManager::initialize_all_turns()
+{
+	// a turn spot's rivers are built by the constructor
+	if (board_has_turn(initialBoard))
+		return;
 
-			for (uint8_t river = turn+1; river < 52; river++)
-			{
-				if (overlap(river, initialBoard))
-					continue;
+	vector<uint8_t> turns;
+	for (uint8_t turn = 0; turn < 52; turn++)
+		if (!overlap(turn, initialBoard))
+			turns.push_back(turn);
 
-				uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, river };
-				int key = get_key(board);
-				vector<Hand> hands;
+	initialize_turns(turns);
+	release_hand_evaluator();
+}
 
-				for (Hand hand : turnHands)
-				{
-					if (overlap(hand, river))
-						continue;
+void RangeManager::release_hand_evaluator()
+{
+	std::lock_guard<std::mutex> lock(handEvaluatorMutex);
+	handEvaluator.reset();
+}
 
-					Hand newHand = Hand(hand.card1, hand.card2);
-					newHand.probability = hand.probability;
-					newHand.rank = handEvaluator->get_hand_rank(newHand.card1, newHand.card2, board);
-					hands.push_back(newHand);
-				}
+shared_ptr<HandEvaluator> RangeManager::acquire_hand_evaluator()
+{
+	std::lock_guard<std::mutex> lock(handEvaluatorMutex);
+	return handEvaluator ? handEvaluator : HandEvaluator::get_instance();
+}
 
-				ranges[key] = hands;
+// The turn board of a flop spot and every river after the turn card, one task
+// per player and board. Every board has its own slots in the packed arrays.
+void RangeManager::initialize_turn(uint8_t turn)
+{
+	std::call_once(turnsInitialized[turn], [&] {
+		const bool flopSpot = !board_has_turn(initialBoard);
+		uint8_t turnBoard[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, 52 };
 
-				uint8_t symmetricalBoard[5] = { initialBoard[0], initialBoard[1], initialBoard[2], river, turn };
-				int symmetricalKey = get_key(symmetricalBoard);
-				ranges[symmetricalKey] = hands;
-			}
-		}
-	}
-	else if (!board_has_river(initialBoard))
-	{
+		vector<uint8_t> rivers;
 		for (uint8_t river = 0; river < 52; river++)
-		{
-			if (overlap(river, initialBoard))
-				continue;
-
-			uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], initialBoard[3], river };
-			int key = get_key(board);
-			vector<Hand> hands;
-
-			for (Hand hand : startingHands)
+			if (!overlap(river, turnBoard))
+				rivers.push_back(river);
+
+		// a flop spot's turn board first, at slot 0 of each player
+		const int firstSlot = flopSpot ? 0 : 1;
+		const int slotCount = 1 + rivers.size();
+		shared_ptr<HandEvaluator> evaluator = acquire_hand_evaluator();
+		int boardState = evaluator->get_board_state(initialBoard);
+
+		// isolated, so a thread waiting here never picks up another card's
+		// initialize_turn and blocks on its own once_flag
+		tbb::this_task_arena::isolate([&] { tbb::parallel_for(0, 2 * slotCount, [&](int task) {
+			int player = task / slotCount + 1;
+			int slot = task % slotCount;
+			if (slot < firstSlot)
+				return;
+
+			if (slot == 0)
 			{
-				if (overlap(hand, river))
-					continue;
-
-				Hand newHand = Hand(hand.card1, hand.card2);
-				newHand.probability = hand.probability;
-				newHand.rank = handEvaluator->get_hand_rank(newHand.card1, newHand.card2, board);
-				hands.push_back(newHand);
+				initialize_turn_range(player, turn);
+				return;
 			}
 
-			ranges[key] = hands;
-		}
-	}
+			// a flop spot's two cards are added lower card first, so both
+			// orders of a turn and river get the same ranks
+			uint8_t river = rivers[slot - 1];
+			int riverState = flopSpot
+				? evaluator->add_card(evaluator->add_card(boardState, min(turn, river)), max(turn, river))
+				: evaluator->add_card(boardState, river);
+			initialize_river_range(player, turn, river, riverState, *evaluator);
+		}); });
+
+		turnsBuilt[turn] = true;
+	});
 }
 
-void RangeManager::quickSort(vector<Hand>& hands, vector<int>& handMap, int low, int high)
+void RangeManager::initialize_turn_range(int player, uint8_t turn)
 {
-	if (low < high)
+	vector<Hand>& startingHands = get_starting_hands(player);
+	uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, 52 };
+	int boardIndex = get_board_index(board);
+
+	Hand* turnHands = get_hands(player, boardIndex);
+	int* reachProbsMapping = get_reach_probs_mapping(player, boardIndex);
+
+	int i = 0;
+	for (int j = 0; j < (int)startingHands.size(); j++)
 	{
-		int pi = partition(hands, handMap, low, high);
-		quickSort(hands, handMap, low, pi - 1);
-		quickSort(hands, handMap, pi + 1, high);
+		if (overlap(startingHands[j], turn))
+			continue;
+
+		turnHands[i] = Hand(startingHands[j].card1, startingHands[j].card2);
+		turnHands[i].probability = startingHands[j].probability;
+		reachProbsMapping[i] = j;
+		i++;
 	}
 }
 
-int RangeManager::partition(vector<Hand>& hands, vector<int>& handMap, int low, int high)
+// River hands are sorted by rank, and map to their index among the turn hands.
+void RangeManager::initialize_river_range(int player, uint8_t turn, uint8_t river, int riverState, HandEvaluator& evaluator)
 {
-	int pivot = hands[high].rank;
-	int i = low - 1;
-	for (int j = low; j <= high - 1; j++)
+	vector<Hand>& startingHands = get_starting_hands(player);
+	uint8_t board[5] = { initialBoard[0], initialBoard[1], initialBoard[2], turn, river };
+	int boardIndex = get_board_index(board);
+
+	vector<Hand> hands;
+	vector<int> turnIndices;
+	int turnHand = 0;
+	for (Hand& hand : startingHands)
 	{
-		if (hands[j].rank <= pivot)
+		if (overlap(hand, turn))
+			continue;
+
+		if (!overlap(hand, river))
 		{
-			i++;
-			Hand handTemp = hands[i];
-			hands[i] = hands[j];
-			hands[j] = handTemp;
-
-			int intTemp = handMap[i];
-			handMap[i] = handMap[j];
-			handMap[j] = intTemp;
+			Hand newHand = Hand(hand.card1, hand.card2);
+			newHand.probability = hand.probability;
+			hands.push_back(newHand);
+			turnIndices.push_back(turnHand);
 		}
+		turnHand++;
 	}
-	Hand handTemp = hands[i+1];
-	hands[i+1] = hands[high];
-	hands[high] = handTemp;
 
-	int intTemp = handMap[i+1];
-	handMap[i+1] = handMap[high];
-	handMap[high] = intTemp;
+	evaluator.set_hand_ranks(riverState, hands.data(), hands.size());
 
-	return i+1;
+	// stable, so hands of equal rank stay in turn range order; boards where
+	// many hands tie (the board plays) would make a quicksort quadratic
+	vector<int> order(hands.size());
+	iota(begin(order), end(order), 0);
+	stable_sort(begin(order), end(order), [&hands](int a, int b) { return compare_hands(hands[a], hands[b]); });
+
+	Hand* riverHands = get_hands(player, boardIndex);
+	int* reachProbsMapping = get_reach_probs_mapping(player, boardIndex);
+	for (int i = 0; i < (int)order.size(); i++)
+	{
+		riverHands[i] = hands[order[i]];
+		reachProbsMapping[i] = turnIndices[order[i]];
+	}
 }
 
 bool RangeManager::compare_hands(Hand h1, Hand h2)
@@ -345,59 +361,111 @@ bool RangeManager::compare_hands(Hand h1, Hand h2)
     return h1.rank < h2.rank;
 }
 
-int RangeManager::get_num_hands(int player, uint8_t board[5])
+vector<Hand>& RangeManager::get_starting_hands(int player)
 {
-	vector<Hand>& hands = get_hands(player, board);
-	return hands.size();
+	return (player == 1) ? p1StartingHands : p2StartingHands;
 }
 
-vector<Hand>& RangeManager::get_starting_hands(int player)
+void RangeManager::get_reach_probs(int player, int boardIndex, const float* reachProbs, float* newReachProbs)
 {
-	return (player == 1) ? p1StartingHands : p2StartingHands;
+	int* reachProbsMapping = get_reach_probs_mapping(player, boardIndex);
+	int numHands = get_num_hands(player, boardIndex);
+
+	for (int i = 0; i < numHands; i++)
+		newReachProbs[i] = reachProbs[reachProbsMapping[i]];
 }
 
-unordered_map<int, vector<int>>& RangeManager::get_reach_probs_mappings(int player)
+vector<float> RangeManager::get_initial_reach_probs(int player)
 {
-	return (player == 1) ? p1ReachProbsMapping : p2ReachProbsMapping;
+	vector<Hand>& startingHands = get_starting_hands(player);
+
+	vector<float> reachProbs(startingHands.size());
+
+	for (int hand = 0; hand < startingHands.size(); hand++)
+		reachProbs[hand] = startingHands[hand].probability;
+
+	return reachProbs;
 }
 
-unordered_map<int, vector<Hand>>& RangeManager::get_ranges(int player)
+void RangeManager::initialize_allin_equity(uint8_t board[5])
 {
-	return (player == 1) ? p1Ranges : p2Ranges;
+	if (board_has_turn(board))
+		initialize_turn(board[3]);
+	else
+		initialize_all_turns();
+
+	unique_ptr<AllinEquity>& allinEquity = allinEquities[get_board_index(board)];
+	if (!allinEquity)
+		allinEquity = std::make_unique<AllinEquity>(*this, board);
 }
 
-vector<Hand>& RangeManager::get_hands(int player, uint8_t board[5])
+AllinEquity& RangeManager::get_allin_equity(int boardIndex)
 {
-	unordered_map<int, vector<Hand>>& ranges = get_ranges(player);
-	return ranges[get_key(board)];
+	return *allinEquities[boardIndex];
 }
 
-vector<int>& RangeManager::get_reach_probs_mapping(int player, uint8_t board[5])
+void RangeManager::initialize_suit_symmetries()
 {
-	unordered_map<int, vector<int>>& reachProbsMappings = get_reach_probs_mappings(player);
-	return reachProbsMappings[get_key(board)];
+	for (int permutation = 0; permutation < SUIT_PERMUTATION_COUNT; permutation++)
+		suitSymmetries[permutation] = is_suit_symmetric(p1StartingHands, permutation)
+			&& is_suit_symmetric(p2StartingHands, permutation);
 }
 
-vector<float> RangeManager::get_reach_probs(int player, uint8_t board[5], vector<float>& reachProbs)
+// True if the permutation maps every hand onto a hand of the same weight.
+bool RangeManager::is_suit_symmetric(vector<Hand>& hands, int permutation)
 {
-	vector<int>& reachProbsMapping = get_reach_probs_mapping(player, board);
+	float weights[52][52];
+	for (int i = 0; i < 52; i++)
+		for (int j = 0; j < 52; j++)
+			weights[i][j] = 0;
 
-	vector<float> newReachProbs(reachProbsMapping.size());
+	for (Hand& hand : hands)
+	{
+		weights[hand.card1][hand.card2] = hand.probability;
+		weights[hand.card2][hand.card1] = hand.probability;
+	}
 
-	for (int i = 0; i < reachProbsMapping.size(); i++)
-		newReachProbs[i] = reachProbs[reachProbsMapping[i]];
+	for (Hand& hand : hands)
+		if (weights[permute_suits(hand.card1, permutation)][permute_suits(hand.card2, permutation)] != hand.probability)
+			return false;
 
-	return newReachProbs;
+	return true;
 }
 
-vector<float> RangeManager::get_initial_reach_probs(int player)
+void RangeManager::initialize_suit_permutation(int boardIndex, int permutation)
 {
-	vector<Hand>& startingHands = get_starting_hands(player);
+	// a turn board's hands are built with its turn card
+	if (boardIndex / 53 < 52)
+		initialize_turn(boardIndex / 53);
 
-	vector<float> reachProbs(startingHands.size());
+	for (int player = 1; player <= 2; player++)
+	{
+		vector<vector<int>>& suitPermutations = (player == 1) ? p1SuitPermutations : p2SuitPermutations;
+		vector<int>& suitPermutation = suitPermutations[get_suit_permutation_index(boardIndex, permutation)];
+		if (!suitPermutation.empty())
+			continue;
 
-	for (int hand = 0; hand < startingHands.size(); hand++)
-		reachProbs[hand] = startingHands[hand].probability;
+		Hand* hands = get_hands(player, boardIndex);
+		int numHands = get_num_hands(player, boardIndex);
 
-	return reachProbs;
-}
\ No newline at end of file
+		int indices[52][52];
+		for (int i = 0; i < 52; i++)
+			for (int j = 0; j < 52; j++)
+				indices[i][j] = -1;
+
+		for (int i = 0; i < numHands; i++)
+		{
+			indices[hands[i].card1][hands[i].card2] = i;
+			indices[hands[i].card2][hands[i].card1] = i;
+		}
+
+		suitPermutation.resize(numHands);
+		for (int i = 0; i < numHands; i++)
+		{
+			int index = indices[permute_suits(hands[i].card1, permutation)][permute_suits(hands[i].card2, permutation)];
+			if (index == -1)
+				throw std::runtime_error("suit permutation does not map the range onto itself");
+			suitPermutation[i] = index;
+		}
+	}
+}
@@ -2,16 +2,20 @@
 #define RANGE_MANAGER_H
 
 #include <vector>
-#include <unordered_map>
 #include <set>
 #include "Hand.h"
 #include "card_utility.h"
 #include <iostream>
 #include <string>
 #include "HandEvaluator.h"
+#include "AllinEquity.h"
+#include <memory>
+#include <mutex>
+#include <atomic>
 using std::vector;
+using std::unique_ptr;
+using std::shared_ptr;
 using std::set;
-using std::unordered_map;
 using std::string;
 
 class RangeManager
@@ -20,52 +24,132 @@ class RangeManager
 		vector<Hand> p1StartingHands;
 		vector<Hand> p2StartingHands;
 
-		unordered_map<int, vector<Hand>> p1Ranges;
-		unordered_map<int, vector<Hand>> p2Ranges;
+		uint8_t initialBoard[5];
 
-		unordered_map<int, vector<int>> p1ReachProbsMapping;
-		unordered_map<int, vector<int>> p2ReachProbsMapping;
+		// Ranges of every board reachable from the initial board, stored back
+		// to back per player and located through the board index. The reach
+		// probs mapping of a board has the same layout as its hands. The
+		// offsets are counted up front, so every board's size is known before
+		// its hands are.
+		vector<Hand> p1Hands;
+		vector<Hand> p2Hands;
+		vector<int> p1ReachProbsMapping;
+		vector<int> p2ReachProbsMapping;
+		vector<int> p1Offsets;
+		vector<int> p2Offsets;
 
-        HandEvaluator* handEvaluator;
+		// The turn board and river boards of each turn card are filled in
+		// once, by the first initialize_turn for that card
+		std::once_flag turnsInitialized[52];
+		std::atomic<bool> turnsBuilt[52] = {};
 
-		void quickSort(vector<Hand>& hands, vector<int>& handMap, int low, int high);
-		int partition(vector<Hand>& hands, vector<int>& handMap, int low, int high);
+		vector<unique_ptr<AllinEquity>> allinEquities;
+
+		// Suit permutations both starting ranges are invariant under, and
+		// the hand permutations they induce per chance node board. Chance
+		// nodes only sit on flop and turn boards, so those are indexed by
+		// the turn slot alone.
+		bool suitSymmetries[SUIT_PERMUTATION_COUNT];
+		vector<vector<int>> p1SuitPermutations;
+		vector<vector<int>> p2SuitPermutations;
+
+		// Held while a flop spot's tree is built, so every chance node's turn
+		// cards share one load of the rank tables. Cards built after
+		// release_hand_evaluator get it from HandEvaluator::get_instance again.
+		shared_ptr<HandEvaluator> handEvaluator;
+		std::mutex handEvaluatorMutex;
+		shared_ptr<HandEvaluator> acquire_hand_evaluator();
 
         static bool compare_hands(Hand h1, Hand h2);
 		void initialize_starting_range(int player, string startingHands, uint8_t initialBoard[5]);
+		void initialize_offsets(int player);
+		void initialize_turn(uint8_t turn);
+		void initialize_turn_range(int player, uint8_t turn);
+		void initialize_river_range(int player, uint8_t turn, uint8_t river, int riverState, HandEvaluator& evaluator);
+		void initialize_suit_symmetries();
+		bool is_suit_symmetric(vector<Hand>& hands, int permutation);
 
-		inline int get_key(uint8_t board[5])
+		static inline int get_suit_permutation_index(int boardIndex, int permutation)
 		{
-			if (!board_has_turn(board))
-				return 100000000 * (board[0] + 1) +
-				1000000 * (board[1] + 1) +
-				10000 * (board[2] + 1);
-			else if (!board_has_river(board))
-				return
-				100000000 * (board[0] + 1) +
-				1000000 * (board[1] + 1) +
-				10000 * (board[2] + 1) +
-				100 * (board[3] + 1);
-			return 100000000 * (board[0] + 1) +
-				1000000 * (board[1] + 1) +
-				10000 * (board[2] + 1) +
-				100 * (board[3] + 1) +
-				(board[4] + 1);
+			return boardIndex / 53 * SUIT_PERMUTATION_COUNT + permutation;
 		}
 
     public:
+		// Every flop, turn and river board that can follow one initial flop
+		// differs only in its turn and river slot (52 when not dealt).
+		static const int BOARD_INDEX_COUNT = 53 * 53;
+
+		// Builds the starting ranges and the size of every board's range. The
+		// ranges of a turn spot's rivers are built here too, a flop spot's
+		// turn cards wait for initialize_turns.
 		RangeManager(string p1StartingHands, string p2StartingHands, uint8_t initialBoard[5]);
-		void initialize_ranges(int player, uint8_t initialBoard[5]);
-		void initialize_reach_probs_mapping(int player, uint8_t initialBoard[5]);
-		vector<float> get_reach_probs(int player, uint8_t board[5], vector<float>& reachProbs);
-		vector<float> get_initial_reach_probs(int player);
 
-		int get_num_hands(int player, uint8_t board[5]);
+		// Builds the turn board and river ranges of every card in turns that
+		// isn't built yet, the cards and both players in parallel. Safe to
+		// call concurrently, a card being built by another thread is waited
+		// for. GameTree calls it for the turn cards it deals, so cards suit
+		// isomorphism skips are never built.
+		void initialize_turns(const vector<uint8_t>& turns);
+		void initialize_all_turns();
+
+		// Drops the hand evaluator once the tree's turn cards are built.
+		// GameTree::build calls it, suit isomorphism may leave cards unbuilt.
+		void release_hand_evaluator();
+
+		// A board's handle into the range tables. Traversals resolve it once
+		// per board and pass it down instead of the cards.
+		static inline int get_board_index(uint8_t board[5])
+		{
+			return board[3] * 53 + board[4];
+		}
+
 		vector<Hand>& get_starting_hands(int player);
-		unordered_map<int, vector<int>>& get_reach_probs_mappings(int player);
-		unordered_map<int, vector<Hand>>& get_ranges(int player);
-		vector<Hand>& get_hands(int player, uint8_t board[5]);
-		vector<int>& get_reach_probs_mapping(int player, uint8_t board[5]);
+		vector<float> get_initial_reach_probs(int player);
+
+		inline int get_num_hands(int player, int boardIndex)
+		{
+			vector<int>& offsets = (player == 1) ? p1Offsets : p2Offsets;
+			return offsets[boardIndex + 1] - offsets[boardIndex];
+		}
+
+		// hands of a board in ascending rank order once the river is dealt
+		inline Hand* get_hands(int player, int boardIndex)
+		{
+			vector<int>& offsets = (player == 1) ? p1Offsets : p2Offsets;
+			return ((player == 1) ? p1Hands.data() : p2Hands.data()) + offsets[boardIndex];
+		}
+
+		// index of each hand in the range of the board one card earlier
+		inline int* get_reach_probs_mapping(int player, int boardIndex)
+		{
+			vector<int>& offsets = (player == 1) ? p1Offsets : p2Offsets;
+			return ((player == 1) ? p1ReachProbsMapping.data() : p2ReachProbsMapping.data()) + offsets[boardIndex];
+		}
+
+		void get_reach_probs(int player, int boardIndex, const float* reachProbs, float* newReachProbs);
+
+		// Built while the tree is built, for every board with an allin node,
+		// so lookups during training never modify the table. Every board has
+		// its own slot, so calls for distinct boards may run concurrently. A
+		// flop board needs the ranges of every turn card and builds them.
+		void initialize_allin_equity(uint8_t board[5]);
+		AllinEquity& get_allin_equity(int boardIndex);
+
+		inline bool is_suit_symmetry(int permutation)
+		{
+			return suitSymmetries[permutation];
+		}
+
+		// Index of the suit permuted image of every hand of a flop or turn
+		// board in that board's own range. Built while the tree is built,
+		// for every symmetry a chance node uses.
+		void initialize_suit_permutation(int boardIndex, int permutation);
+
+		inline int* get_suit_permutation(int player, int boardIndex, int permutation)
+		{
+			vector<vector<int>>& suitPermutations = (player == 1) ? p1SuitPermutations : p2SuitPermutations;
+			return suitPermutations[get_suit_permutation_index(boardIndex, permutation)].data();
+		}
 };
 
 #endif
\ No newline at end of file
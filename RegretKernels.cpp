@@ -0,0 +1,492 @@
+#include "RegretKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define REGRET_KERNELS_X86
+#endif
+using std::pow;
+using std::vector;
+
+const DcfrDiscount& DcfrDiscount::get(int iterationCount)
+{
+    thread_local DcfrDiscount discount;
+    thread_local int cachedIterationCount = 0;
+
+    if (iterationCount != cachedIterationCount)
+    {
+        float x = pow(iterationCount, 1.5f);
+        discount.positiveRegret = x / (x + 1);
+        discount.negativeRegret = 0.5f;
+        discount.strategyWeight = (float)iterationCount * iterationCount;
+        cachedIterationCount = iterationCount;
+    }
+
+    return discount;
+}
+
+DcfrDiscount DcfrDiscount::get_skipped(int lastIteration, int iterationCount)
+{
+    // products of the positive discounts of iterations 1..t, extended as
+    // iterations go by. They converge to about 0.11, so the quotient of two
+    // of them stays exact enough in double.
+    thread_local vector<double> cumulativePositive(1, 1.0);
+
+    while ((int)cumulativePositive.size() < iterationCount)
+    {
+        double x = pow((double)cumulativePositive.size(), 1.5);
+        cumulativePositive.push_back(cumulativePositive.back() * x / (x + 1));
+    }
+
+    DcfrDiscount discount;
+    discount.positiveRegret = (float)(cumulativePositive[iterationCount - 1] / cumulativePositive[lastIteration]);
+    discount.negativeRegret = std::ldexp(1.0f, -std::min(iterationCount - 1 - lastIteration, 200));
+    discount.strategyWeight = 0;
+    return discount;
+}
+
+// Scalar conversions, also used for the elements after the last full vector.
+static inline float float16_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0)
+    {
+        // zero or subnormal, mantissa * 2^-24
+        float f = mantissa * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+
+    uint32_t bits = (exponent == 0x1f)
+        ? sign | 0x7f800000 | (mantissa << 13)
+        : sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// rounds to nearest even like the F16C instructions
+static inline uint16_t float_to_float16(float f)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000)
+        return sign | 0x7e00;
+    if (magnitude >= 0x477ff000) // 65520 and above round to infinity
+        return sign | 0x7c00;
+    if (magnitude < 0x38800000) // below 2^-14, subnormal in half precision
+    {
+        float value;
+        std::memcpy(&value, &magnitude, sizeof(value));
+        return sign | (uint16_t)std::lrintf(value * 16777216.0f);
+    }
+
+    uint32_t h = (magnitude - 0x38000000) >> 13;
+    uint32_t rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        h++;
+    return sign | h;
+}
+
+static inline float bfloat16_to_float(uint16_t h)
+{
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t float_to_bfloat16(float f)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return bits >> 16;
+}
+
+static inline uint16_t float_to_int16(float f)
+{
+    long q = std::lrintf(f);
+    return (uint16_t)(int16_t)std::min(std::max(q, -32768L), 32767L);
+}
+
+template <StorageType TYPE>
+static inline float decode_value(uint16_t encoded, float scale)
+{
+    if constexpr (TYPE == StorageType::FLOAT16)
+        return float16_to_float(encoded) * scale;
+    else if constexpr (TYPE == StorageType::BFLOAT16)
+        return bfloat16_to_float(encoded);
+    else
+        return (int16_t)encoded * scale;
+}
+
+// value is already divided by the scale
+template <StorageType TYPE>
+static inline uint16_t encode_value(float value)
+{
+    if constexpr (TYPE == StorageType::FLOAT16)
+        return float_to_float16(value);
+    else if constexpr (TYPE == StorageType::BFLOAT16)
+        return float_to_bfloat16(value);
+    else
+        return float_to_int16(value);
+}
+
+// what the largest magnitude of a block is scaled to, well inside the range
+template <StorageType TYPE>
+static inline float get_scaled_range()
+{
+    return (TYPE == StorageType::FLOAT16) ? 32768.0f : 32767.0f;
+}
+
+typedef void (*RegretMatchingKernel)(const float*, float*, int, int);
+typedef void (*UpdateRegretsKernel)(float*, const float*, int, int, const DcfrDiscount&);
+typedef void (*UpdateStrategySumKernel)(float*, const float*, const float*, int, int, const DcfrDiscount&);
+typedef void (*UpdateHeroNodeKernel)(float*, const float*, float*, int, int, const DcfrDiscount&);
+typedef void (*UpdateVillainNodeKernel)(const float*, float*, const float*, float*, int, int, const DcfrDiscount&);
+typedef void (*DecodeKernel)(const uint16_t*, float, float*, int);
+typedef float (*EncodeKernel)(const float*, uint16_t*, int);
+
+// kernels of one instruction set, indexed by action count
+class KernelTable
+{
+    public:
+        RegretMatchingKernel regretMatching[RegretKernels::MAX_UNROLLED_ACTIONS + 1];
+        UpdateRegretsKernel updateRegrets[RegretKernels::MAX_UNROLLED_ACTIONS + 1];
+        UpdateStrategySumKernel updateStrategySum[RegretKernels::MAX_UNROLLED_ACTIONS + 1];
+        UpdateHeroNodeKernel updateHeroNode[RegretKernels::MAX_UNROLLED_ACTIONS + 1];
+        UpdateVillainNodeKernel updateVillainNode[RegretKernels::MAX_UNROLLED_ACTIONS + 1];
+
+        // indexed by StorageType, nothing for FLOAT32
+        DecodeKernel decode[4];
+        EncodeKernel encode[4];
+};
+
+namespace scalar
+{
+    class Simd
+    {
+        public:
+            typedef float V;
+            static const int WIDTH = 1;
+
+            static inline V load(const float* p) { return *p; }
+            static inline V load_partial(const float* p, int /*count*/) { return *p; }
+            static inline void store(float* p, V v) { *p = v; }
+            static inline void store_partial(float* p, V v, int /*count*/) { *p = v; }
+            static inline V zero() { return 0.0f; }
+            static inline V set1(float x) { return x; }
+            static inline V add(V a, V b) { return a + b; }
+            static inline V sub(V a, V b) { return a - b; }
+            static inline V mul(V a, V b) { return a * b; }
+            static inline V div(V a, V b) { return a / b; }
+            static inline V max(V a, V b) { return a > b ? a : b; }
+            static inline V fmadd(V a, V b, V c) { return a * b + c; }
+            static inline V select_positive(V x, V a, V b) { return x > 0.0f ? a : b; }
+            static inline V abs(V a) { return std::fabs(a); }
+            static inline float reduce_max(V a) { return a; }
+
+            static inline V decode_float16(const uint16_t* p) { return float16_to_float(*p); }
+            static inline V decode_bfloat16(const uint16_t* p) { return bfloat16_to_float(*p); }
+            static inline V decode_int16(const uint16_t* p) { return (int16_t)*p; }
+            static inline void encode_float16(uint16_t* p, V v) { *p = float_to_float16(v); }
+            static inline void encode_bfloat16(uint16_t* p, V v) { *p = float_to_bfloat16(v); }
+            static inline void encode_int16(uint16_t* p, V v) { *p = float_to_int16(v); }
+    };
+
+    #include "RegretKernelsImpl.h"
+}
+
+#ifdef REGRET_KERNELS_X86
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+namespace avx2
+{
+    class Simd
+    {
+        public:
+            typedef __m256 V;
+            static const int WIDTH = 8;
+
+            static inline __m256i tail_mask(int count)
+            {
+                return _mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            }
+
+            static inline V load(const float* p) { return _mm256_loadu_ps(p); }
+            static inline V load_partial(const float* p, int count) { return _mm256_maskload_ps(p, tail_mask(count)); }
+            static inline void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+            static inline void store_partial(float* p, V v, int count) { _mm256_maskstore_ps(p, tail_mask(count), v); }
+            static inline V zero() { return _mm256_setzero_ps(); }
+            static inline V set1(float x) { return _mm256_set1_ps(x); }
+            static inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+            static inline V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+            static inline V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+            static inline V div(V a, V b) { return _mm256_div_ps(a, b); }
+            static inline V max(V a, V b) { return _mm256_max_ps(a, b); }
+            static inline V fmadd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+            static inline V select_positive(V x, V a, V b)
+            {
+                return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ));
+            }
+            static inline V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+            static inline float reduce_max(V a)
+            {
+                __m128 m = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+                m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+                m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+                return _mm_cvtss_f32(m);
+            }
+
+            // packs the low 16 bits of eight 32-bit lanes, PACKUS or PACKS saturating
+            static inline void store_epi16(uint16_t* p, __m256i packed)
+            {
+                _mm_storeu_si128((__m128i*) p, _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08)));
+            }
+
+            static inline V decode_float16(const uint16_t* p) { return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) p)); }
+            static inline V decode_bfloat16(const uint16_t* p)
+            {
+                return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) p)), 16));
+            }
+            static inline V decode_int16(const uint16_t* p) { return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) p))); }
+            static inline void encode_float16(uint16_t* p, V v) { _mm_storeu_si128((__m128i*) p, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT)); }
+            static inline void encode_bfloat16(uint16_t* p, V v)
+            {
+                __m256i bits = _mm256_castps_si256(v);
+                __m256i rounding = _mm256_add_epi32(_mm256_set1_epi32(0x7fff), _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1)));
+                bits = _mm256_srli_epi32(_mm256_add_epi32(bits, rounding), 16);
+                store_epi16(p, _mm256_packus_epi32(bits, bits));
+            }
+            static inline void encode_int16(uint16_t* p, V v)
+            {
+                __m256i q = _mm256_cvtps_epi32(v);
+                store_epi16(p, _mm256_packs_epi32(q, q));
+            }
+    };
+
+    #include "RegretKernelsImpl.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+namespace avx512
+{
+    class Simd
+    {
+        public:
+            typedef __m512 V;
+            static const int WIDTH = 16;
+
+            // GCC's unmasked forms of several intrinsics start from a vector
+            // initialized with itself, which -Wall reports; the zero masked
+            // forms with every lane selected compile to the same instructions
+            static const __mmask16 ALL = 0xffff;
+
+            static inline __mmask16 tail_mask(int count) { return (__mmask16)((1u << count) - 1); }
+
+            static inline V load(const float* p) { return _mm512_loadu_ps(p); }
+            static inline V load_partial(const float* p, int count) { return _mm512_maskz_loadu_ps(tail_mask(count), p); }
+            static inline void store(float* p, V v) { _mm512_storeu_ps(p, v); }
+            static inline void store_partial(float* p, V v, int count) { _mm512_mask_storeu_ps(p, tail_mask(count), v); }
+            static inline V zero() { return _mm512_setzero_ps(); }
+            static inline V set1(float x) { return _mm512_set1_ps(x); }
+            static inline V add(V a, V b) { return _mm512_add_ps(a, b); }
+            static inline V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+            static inline V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+            static inline V div(V a, V b) { return _mm512_div_ps(a, b); }
+            static inline V max(V a, V b) { return _mm512_maskz_max_ps(ALL, a, b); }
+            static inline V fmadd(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+            static inline V select_positive(V x, V a, V b)
+            {
+                return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ), b, a);
+            }
+            static inline V abs(V a) { return _mm512_abs_ps(a); }
+            static inline float reduce_max(V a)
+            {
+                __m256 low = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xff, _mm512_castps_pd(a), 0));
+                __m256 high = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xff, _mm512_castps_pd(a), 1));
+                __m256 m8 = _mm256_max_ps(low, high);
+                __m128 m4 = _mm_max_ps(_mm256_castps256_ps128(m8), _mm256_extractf128_ps(m8, 1));
+                __m128 m2 = _mm_max_ps(m4, _mm_movehl_ps(m4, m4));
+                return _mm_cvtss_f32(_mm_max_ss(m2, _mm_shuffle_ps(m2, m2, 1)));
+            }
+
+            static inline V decode_float16(const uint16_t* p) { return _mm512_maskz_cvtph_ps(ALL, _mm256_loadu_si256((const __m256i*) p)); }
+            static inline V decode_bfloat16(const uint16_t* p)
+            {
+                return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(ALL, _mm512_maskz_cvtepu16_epi32(ALL, _mm256_loadu_si256((const __m256i*) p)), 16));
+            }
+            static inline V decode_int16(const uint16_t* p)
+            {
+                return _mm512_maskz_cvtepi32_ps(ALL, _mm512_maskz_cvtepi16_epi32(ALL, _mm256_loadu_si256((const __m256i*) p)));
+            }
+            static inline void encode_float16(uint16_t* p, V v)
+            {
+                _mm256_storeu_si256((__m256i*) p, _mm512_maskz_cvtps_ph(ALL, v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+            }
+            static inline void encode_bfloat16(uint16_t* p, V v)
+            {
+                __m512i bits = _mm512_castps_si512(v);
+                __m512i rounding = _mm512_add_epi32(_mm512_set1_epi32(0x7fff), _mm512_and_si512(_mm512_maskz_srli_epi32(ALL, bits, 16), _mm512_set1_epi32(1)));
+                _mm256_storeu_si256((__m256i*) p, _mm512_maskz_cvtepi32_epi16(ALL, _mm512_maskz_srli_epi32(ALL, _mm512_add_epi32(bits, rounding), 16)));
+            }
+            static inline void encode_int16(uint16_t* p, V v)
+            {
+                _mm256_storeu_si256((__m256i*) p, _mm512_maskz_cvtsepi32_epi16(ALL, _mm512_maskz_cvtps_epi32(ALL, v)));
+            }
+    };
+
+    #include "RegretKernelsImpl.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+// Each table is built on first use only. make_table is compiled for its
+// instruction set, so building a table the CPU can't run would fault.
+static const KernelTable* get_table(InstructionSet instructionSet)
+{
+#ifdef REGRET_KERNELS_X86
+    if (instructionSet == InstructionSet::AVX512)
+    {
+        static const KernelTable avx512Table = avx512::make_table();
+        return &avx512Table;
+    }
+    if (instructionSet == InstructionSet::AVX2)
+    {
+        static const KernelTable avx2Table = avx2::make_table();
+        return &avx2Table;
+    }
+#endif
+    static const KernelTable scalarTable = scalar::make_table();
+    return &scalarTable;
+}
+
+static InstructionSet detect_instruction_set()
+{
+#ifdef REGRET_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return InstructionSet::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+        return InstructionSet::AVX2;
+#endif
+    return InstructionSet::SCALAR;
+}
+
+static InstructionSet& current_instruction_set()
+{
+    static InstructionSet instructionSet = detect_instruction_set();
+    return instructionSet;
+}
+
+static const KernelTable*& current_table()
+{
+    static const KernelTable* table = get_table(current_instruction_set());
+    return table;
+}
+
+static inline int get_table_index(int numActions)
+{
+    return (numActions <= RegretKernels::MAX_UNROLLED_ACTIONS) ? numActions : 0;
+}
+
+void RegretKernels::regret_matching(const float* sums, float* strategy, int numHands, int numActions)
+{
+    current_table()->regretMatching[get_table_index(numActions)](sums, strategy, numHands, numActions);
+}
+
+void RegretKernels::update_regrets(float* regretSum, const float* utilities, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    current_table()->updateRegrets[get_table_index(numActions)](regretSum, utilities, numHands, numActions, discount);
+}
+
+void RegretKernels::discount_regrets(float* regretSum, int count, const DcfrDiscount& discount)
+{
+    // only for nodes that were skipped, so not worth a dispatched kernel
+    for (int i = 0; i < count; i++)
+        regretSum[i] *= (regretSum[i] > 0) ? discount.positiveRegret : discount.negativeRegret;
+}
+
+void RegretKernels::update_strategy_sum(float* strategySum, const float* strategy, const float* reachProbs, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    current_table()->updateStrategySum[get_table_index(numActions)](strategySum, strategy, reachProbs, numHands, numActions, discount);
+}
+
+void RegretKernels::update_hero_node(float* regretSum, const float* actionUtilities, float* utilities, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    current_table()->updateHeroNode[get_table_index(numActions)](regretSum, actionUtilities, utilities, numHands, numActions, discount);
+}
+
+void RegretKernels::update_villain_node(const float* regretSum, float* strategySum, const float* reachProbs, float* actionReachProbs, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    current_table()->updateVillainNode[get_table_index(numActions)](regretSum, strategySum, reachProbs, actionReachProbs, numHands, numActions, discount);
+}
+
+void RegretKernels::decode(StorageType storageType, const uint16_t* encoded, float scale, float* values, int count)
+{
+    current_table()->decode[(int)storageType](encoded, scale, values, count);
+}
+
+float RegretKernels::encode(StorageType storageType, const float* values, uint16_t* encoded, int count)
+{
+    return current_table()->encode[(int)storageType](values, encoded, count);
+}
+
+bool RegretKernels::is_supported(InstructionSet instructionSet)
+{
+    static const InstructionSet best = detect_instruction_set();
+    return (int)instructionSet <= (int)best;
+}
+
+InstructionSet RegretKernels::get_instruction_set()
+{
+    return current_instruction_set();
+}
+
+const char* RegretKernels::get_name(InstructionSet instructionSet)
+{
+    if (instructionSet == InstructionSet::AVX512)
+        return "AVX-512";
+    if (instructionSet == InstructionSet::AVX2)
+        return "AVX2";
+    return "scalar";
+}
+
+void RegretKernels::set_instruction_set(InstructionSet instructionSet)
+{
+    if (!is_supported(instructionSet))
+        throw std::runtime_error(std::string("CPU does not support ") + get_name(instructionSet));
+
+    current_instruction_set() = instructionSet;
+    current_table() = get_table(instructionSet);
+}
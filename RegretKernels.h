@@ -0,0 +1,90 @@
+#ifndef REGRET_KERNELS_H
+#define REGRET_KERNELS_H
+
+#include <stdint.h>
+#include "StorageTypeEnum.h"
+
+// Discount factors of one DCFR iteration (alpha 1.5, beta 0, gamma 2).
+// Positive regrets are scaled by t^1.5 / (t^1.5 + 1) and negative ones by
+// 0.5.
+//
+// Discounting the strategy sum by (t / (t + 1))^2 every iteration is the
+// same as adding the strategy of iteration t with weight t^2 and dividing
+// the sum by (t + 1)^2. The average strategy is normalized per hand, so the
+// division never has to happen and strategy sums are stored undiscounted.
+class DcfrDiscount
+{
+    public:
+        float positiveRegret;
+        float negativeRegret;
+        float strategyWeight;
+
+        // computed once per iteration and thread instead of once per node
+        static const DcfrDiscount& get(int iterationCount);
+
+        // The combined regret discount of the iterations after lastIteration
+        // and before iterationCount, for a node that wasn't updated in them.
+        // Its regrets didn't change sign either, so one scale per sign
+        // catches them up.
+        static DcfrDiscount get_skipped(int lastIteration, int iterationCount);
+};
+
+enum class InstructionSet
+{
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+// Regret matching and DCFR updates over the [action][hand] blocks of an
+// ActionNode. Every kernel is instantiated for 2 to MAX_UNROLLED_ACTIONS
+// actions and once for any action count, in a scalar, an AVX2 and an
+// AVX-512 version. The widest version the CPU supports is picked on first
+// use.
+class RegretKernels
+{
+    public:
+        static const int MAX_UNROLLED_ACTIONS = 8;
+
+        // Positive part of sums normalized per hand, uniform for hands
+        // without a positive entry. This is the current strategy of regret
+        // sums and the average strategy of (never negative) strategy sums.
+        static void regret_matching(const float* sums, float* strategy, int numHands, int numActions);
+
+        // regretSum = (regretSum - utilities) scaled by the positive or
+        // negative regret discount, utilities is one value per hand
+        static void update_regrets(float* regretSum, const float* utilities, int numHands, int numActions, const DcfrDiscount& discount);
+
+        // Scales every regret by the discount of its sign.
+        static void discount_regrets(float* regretSum, int count, const DcfrDiscount& discount);
+
+        // strategySum += strategy * reachProbs * strategyWeight
+        static void update_strategy_sum(float* strategySum, const float* strategy, const float* reachProbs, int numHands, int numActions, const DcfrDiscount& discount);
+
+        // The fused kernels the tree traversal uses. A hero node, once its
+        // children are done, gets the utility under the current strategy
+        // and its regret update in one pass over regretSum:
+        //   utilities = sum over actions of strategy * actionUtilities
+        //   regretSum = (regretSum + actionUtilities - utilities) discounted
+        // A villain node, before its children, gets the reach probs of
+        // every action and its strategy sum update in one pass:
+        //   actionReachProbs = strategy * reachProbs
+        //   strategySum += actionReachProbs * strategyWeight
+        static void update_hero_node(float* regretSum, const float* actionUtilities, float* utilities, int numHands, int numActions, const DcfrDiscount& discount);
+        static void update_villain_node(const float* regretSum, float* strategySum, const float* reachProbs, float* actionReachProbs, int numHands, int numActions, const DcfrDiscount& discount);
+
+        // Conversions between floats and the 16-bit storage types. encode
+        // returns the scale the block is stored relative to, which decode
+        // takes back (always 1 for BFLOAT16).
+        static void decode(StorageType storageType, const uint16_t* encoded, float scale, float* values, int count);
+        static float encode(StorageType storageType, const float* values, uint16_t* encoded, int count);
+
+        static bool is_supported(InstructionSet instructionSet);
+        static InstructionSet get_instruction_set();
+        static const char* get_name(InstructionSet instructionSet);
+
+        // For benchmarks, must not be called while kernels are running.
+        static void set_instruction_set(InstructionSet instructionSet);
+};
+
+#endif
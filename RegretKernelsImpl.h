@@ -0,0 +1,295 @@
+// Kernel bodies shared by every instruction set. RegretKernels.cpp includes
+// this once per instruction set, inside a namespace that defines Simd and
+// under the matching target pragma, so it deliberately has no include guard.
+//
+// Each kernel walks the hands one vector at a time and handles all actions
+// of those hands in registers. N is the action count, or 0 when it is only
+// known at runtime. The last, partial vector uses masked loads and stores,
+// because rows of a block are packed back to back.
+
+template <bool PARTIAL>
+static inline Simd::V load(const float* p, int count)
+{
+    return PARTIAL ? Simd::load_partial(p, count) : Simd::load(p);
+}
+
+template <bool PARTIAL>
+static inline void store(float* p, Simd::V v, int count)
+{
+    if (PARTIAL)
+        Simd::store_partial(p, v, count);
+    else
+        Simd::store(p, v);
+}
+
+template <int N, bool PARTIAL>
+static inline void regret_matching_step(const float* __restrict sums, float* __restrict strategy, int numHands, int numActions, int hand, int count)
+{
+    const int actions = (N > 0) ? N : numActions;
+    const Simd::V zero = Simd::zero();
+
+    Simd::V total = zero;
+    for (int action = 0; action < actions; action++)
+        total = Simd::add(total, Simd::max(load<PARTIAL>(sums + action * numHands + hand, count), zero));
+
+    // hands without a positive entry divide by zero and take the uniform lane
+    const Simd::V uniform = Simd::set1(1.0f / actions);
+    for (int action = 0; action < actions; action++)
+    {
+        Simd::V positive = Simd::max(load<PARTIAL>(sums + action * numHands + hand, count), zero);
+        store<PARTIAL>(strategy + action * numHands + hand, Simd::select_positive(total, Simd::div(positive, total), uniform), count);
+    }
+}
+
+template <int N, bool PARTIAL>
+static inline void update_regrets_step(float* __restrict regretSum, const float* __restrict utilities, int numHands, int numActions, const DcfrDiscount& discount, int hand, int count)
+{
+    const int actions = (N > 0) ? N : numActions;
+    const Simd::V positiveDiscount = Simd::set1(discount.positiveRegret);
+    const Simd::V negativeDiscount = Simd::set1(discount.negativeRegret);
+    const Simd::V utility = load<PARTIAL>(utilities + hand, count);
+
+    for (int action = 0; action < actions; action++)
+    {
+        float* p = regretSum + action * numHands + hand;
+        Simd::V regret = Simd::sub(load<PARTIAL>(p, count), utility);
+        store<PARTIAL>(p, Simd::mul(regret, Simd::select_positive(regret, positiveDiscount, negativeDiscount)), count);
+    }
+}
+
+template <int N, bool PARTIAL>
+static inline void update_strategy_sum_step(float* __restrict strategySum, const float* __restrict strategy, const float* __restrict reachProbs, int numHands, int numActions, const DcfrDiscount& discount, int hand, int count)
+{
+    const int actions = (N > 0) ? N : numActions;
+    const Simd::V strategyWeight = Simd::set1(discount.strategyWeight);
+    const Simd::V reach = load<PARTIAL>(reachProbs + hand, count);
+
+    for (int action = 0; action < actions; action++)
+    {
+        float* p = strategySum + action * numHands + hand;
+        Simd::V actionReach = Simd::mul(load<PARTIAL>(strategy + action * numHands + hand, count), reach);
+        store<PARTIAL>(p, Simd::fmadd(actionReach, strategyWeight, load<PARTIAL>(p, count)), count);
+    }
+}
+
+// Regret matching, the node utility and the regret update of a hero node in
+// one pass: every regret is read once and written once.
+template <int N, bool PARTIAL>
+static inline void update_hero_node_step(float* __restrict regretSum, const float* __restrict actionUtilities, float* __restrict utilities, int numHands, int numActions, const DcfrDiscount& discount, int hand, int count)
+{
+    const int actions = (N > 0) ? N : numActions;
+    const Simd::V zero = Simd::zero();
+
+    Simd::V total = zero;
+    for (int action = 0; action < actions; action++)
+        total = Simd::add(total, Simd::max(load<PARTIAL>(regretSum + action * numHands + hand, count), zero));
+
+    const Simd::V uniform = Simd::set1(1.0f / actions);
+    Simd::V utility = zero;
+    for (int action = 0; action < actions; action++)
+    {
+        Simd::V positive = Simd::max(load<PARTIAL>(regretSum + action * numHands + hand, count), zero);
+        Simd::V strategy = Simd::select_positive(total, Simd::div(positive, total), uniform);
+        utility = Simd::fmadd(strategy, load<PARTIAL>(actionUtilities + action * numHands + hand, count), utility);
+    }
+    store<PARTIAL>(utilities + hand, utility, count);
+
+    const Simd::V positiveDiscount = Simd::set1(discount.positiveRegret);
+    const Simd::V negativeDiscount = Simd::set1(discount.negativeRegret);
+    for (int action = 0; action < actions; action++)
+    {
+        float* p = regretSum + action * numHands + hand;
+        Simd::V regret = Simd::sub(Simd::add(load<PARTIAL>(p, count), load<PARTIAL>(actionUtilities + action * numHands + hand, count)), utility);
+        store<PARTIAL>(p, Simd::mul(regret, Simd::select_positive(regret, positiveDiscount, negativeDiscount)), count);
+    }
+}
+
+// Regret matching, the reach probs of every action and the strategy sum
+// update of a villain node in one pass, without a strategy buffer.
+template <int N, bool PARTIAL>
+static inline void update_villain_node_step(const float* __restrict regretSum, float* __restrict strategySum, const float* __restrict reachProbs, float* __restrict actionReachProbs, int numHands, int numActions, const DcfrDiscount& discount, int hand, int count)
+{
+    const int actions = (N > 0) ? N : numActions;
+    const Simd::V zero = Simd::zero();
+
+    Simd::V total = zero;
+    for (int action = 0; action < actions; action++)
+        total = Simd::add(total, Simd::max(load<PARTIAL>(regretSum + action * numHands + hand, count), zero));
+
+    const Simd::V uniform = Simd::set1(1.0f / actions);
+    const Simd::V reach = load<PARTIAL>(reachProbs + hand, count);
+    const Simd::V strategyWeight = Simd::set1(discount.strategyWeight);
+    for (int action = 0; action < actions; action++)
+    {
+        Simd::V positive = Simd::max(load<PARTIAL>(regretSum + action * numHands + hand, count), zero);
+        Simd::V strategy = Simd::select_positive(total, Simd::div(positive, total), uniform);
+        Simd::V actionReach = Simd::mul(strategy, reach);
+        store<PARTIAL>(actionReachProbs + action * numHands + hand, actionReach, count);
+
+        float* p = strategySum + action * numHands + hand;
+        store<PARTIAL>(p, Simd::fmadd(actionReach, strategyWeight, load<PARTIAL>(p, count)), count);
+    }
+}
+
+template <int N>
+static void regret_matching(const float* sums, float* strategy, int numHands, int numActions)
+{
+    int hand = 0;
+    for (; hand + Simd::WIDTH <= numHands; hand += Simd::WIDTH)
+        regret_matching_step<N, false>(sums, strategy, numHands, numActions, hand, Simd::WIDTH);
+    if (hand < numHands)
+        regret_matching_step<N, true>(sums, strategy, numHands, numActions, hand, numHands - hand);
+}
+
+template <int N>
+static void update_regrets(float* regretSum, const float* utilities, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    int hand = 0;
+    for (; hand + Simd::WIDTH <= numHands; hand += Simd::WIDTH)
+        update_regrets_step<N, false>(regretSum, utilities, numHands, numActions, discount, hand, Simd::WIDTH);
+    if (hand < numHands)
+        update_regrets_step<N, true>(regretSum, utilities, numHands, numActions, discount, hand, numHands - hand);
+}
+
+template <int N>
+static void update_strategy_sum(float* strategySum, const float* strategy, const float* reachProbs, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    int hand = 0;
+    for (; hand + Simd::WIDTH <= numHands; hand += Simd::WIDTH)
+        update_strategy_sum_step<N, false>(strategySum, strategy, reachProbs, numHands, numActions, discount, hand, Simd::WIDTH);
+    if (hand < numHands)
+        update_strategy_sum_step<N, true>(strategySum, strategy, reachProbs, numHands, numActions, discount, hand, numHands - hand);
+}
+
+template <int N>
+static void update_hero_node(float* regretSum, const float* actionUtilities, float* utilities, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    int hand = 0;
+    for (; hand + Simd::WIDTH <= numHands; hand += Simd::WIDTH)
+        update_hero_node_step<N, false>(regretSum, actionUtilities, utilities, numHands, numActions, discount, hand, Simd::WIDTH);
+    if (hand < numHands)
+        update_hero_node_step<N, true>(regretSum, actionUtilities, utilities, numHands, numActions, discount, hand, numHands - hand);
+}
+
+template <int N>
+static void update_villain_node(const float* regretSum, float* strategySum, const float* reachProbs, float* actionReachProbs, int numHands, int numActions, const DcfrDiscount& discount)
+{
+    int hand = 0;
+    for (; hand + Simd::WIDTH <= numHands; hand += Simd::WIDTH)
+        update_villain_node_step<N, false>(regretSum, strategySum, reachProbs, actionReachProbs, numHands, numActions, discount, hand, Simd::WIDTH);
+    if (hand < numHands)
+        update_villain_node_step<N, true>(regretSum, strategySum, reachProbs, actionReachProbs, numHands, numActions, discount, hand, numHands - hand);
+}
+
+template <StorageType TYPE>
+static inline Simd::V decode_vector(const uint16_t* p)
+{
+    if constexpr (TYPE == StorageType::FLOAT16)
+        return Simd::decode_float16(p);
+    else if constexpr (TYPE == StorageType::BFLOAT16)
+        return Simd::decode_bfloat16(p);
+    else
+        return Simd::decode_int16(p);
+}
+
+template <StorageType TYPE>
+static inline void encode_vector(uint16_t* p, Simd::V v)
+{
+    if constexpr (TYPE == StorageType::FLOAT16)
+        Simd::encode_float16(p, v);
+    else if constexpr (TYPE == StorageType::BFLOAT16)
+        Simd::encode_bfloat16(p, v);
+    else
+        Simd::encode_int16(p, v);
+}
+
+template <StorageType TYPE>
+static void decode(const uint16_t* encoded, float scale, float* values, int count)
+{
+    const Simd::V scaleVector = Simd::set1(scale);
+    int i = 0;
+    for (; i + Simd::WIDTH <= count; i += Simd::WIDTH)
+    {
+        if constexpr (TYPE == StorageType::BFLOAT16)
+            Simd::store(values + i, decode_vector<TYPE>(encoded + i));
+        else
+            Simd::store(values + i, Simd::mul(decode_vector<TYPE>(encoded + i), scaleVector));
+    }
+    for (; i < count; i++)
+        values[i] = decode_value<TYPE>(encoded[i], scale);
+}
+
+// Scaled types take one pass for the largest magnitude and one to convert.
+template <StorageType TYPE>
+static float encode(const float* values, uint16_t* encoded, int count)
+{
+    float scale = 1.0f;
+    if constexpr (TYPE != StorageType::BFLOAT16)
+    {
+        Simd::V maxVector = Simd::zero();
+        int i = 0;
+        for (; i + Simd::WIDTH <= count; i += Simd::WIDTH)
+            maxVector = Simd::max(maxVector, Simd::abs(Simd::load(values + i)));
+
+        float maxMagnitude = Simd::reduce_max(maxVector);
+        for (; i < count; i++)
+            maxMagnitude = std::max(maxMagnitude, std::fabs(values[i]));
+
+        if (maxMagnitude > 0)
+            scale = maxMagnitude / get_scaled_range<TYPE>();
+    }
+
+    const float inverse = 1.0f / scale;
+    const Simd::V inverseVector = Simd::set1(inverse);
+    int i = 0;
+    for (; i + Simd::WIDTH <= count; i += Simd::WIDTH)
+    {
+        if constexpr (TYPE == StorageType::BFLOAT16)
+            encode_vector<TYPE>(encoded + i, Simd::load(values + i));
+        else
+            encode_vector<TYPE>(encoded + i, Simd::mul(Simd::load(values + i), inverseVector));
+    }
+    for (; i < count; i++)
+        encoded[i] = encode_value<TYPE>((TYPE == StorageType::BFLOAT16) ? values[i] : values[i] * inverse);
+
+    return scale;
+}
+
+template <int N>
+static void fill_table(KernelTable& table)
+{
+    table.regretMatching[N] = regret_matching<N>;
+    table.updateRegrets[N] = update_regrets<N>;
+    table.updateStrategySum[N] = update_strategy_sum<N>;
+    table.updateHeroNode[N] = update_hero_node<N>;
+    table.updateVillainNode[N] = update_villain_node<N>;
+    if constexpr (N > 2)
+        fill_table<N - 1>(table);
+}
+
+static KernelTable make_table()
+{
+    KernelTable table;
+
+    // entry 0 takes every count without a kernel of its own
+    for (int i = 0; i < 2; i++)
+    {
+        table.regretMatching[i] = regret_matching<0>;
+        table.updateRegrets[i] = update_regrets<0>;
+        table.updateStrategySum[i] = update_strategy_sum<0>;
+        table.updateHeroNode[i] = update_hero_node<0>;
+        table.updateVillainNode[i] = update_villain_node<0>;
+    }
+    fill_table<RegretKernels::MAX_UNROLLED_ACTIONS>(table);
+
+    table.decode[(int)StorageType::FLOAT32] = nullptr;
+    table.encode[(int)StorageType::FLOAT32] = nullptr;
+    table.decode[(int)StorageType::FLOAT16] = decode<StorageType::FLOAT16>;
+    table.encode[(int)StorageType::FLOAT16] = encode<StorageType::FLOAT16>;
+    table.decode[(int)StorageType::BFLOAT16] = decode<StorageType::BFLOAT16>;
+    table.encode[(int)StorageType::BFLOAT16] = encode<StorageType::BFLOAT16>;
+    table.decode[(int)StorageType::INT16] = decode<StorageType::INT16>;
+    table.encode[(int)StorageType::INT16] = encode<StorageType::INT16>;
+
+    return table;
+}
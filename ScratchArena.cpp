@@ -0,0 +1,63 @@
+#include "ScratchArena.h"
+#include <tbb/enumerable_thread_specific.h>
+#include <algorithm>
+using std::max;
+
+static const size_t CHUNK_SIZE = 1 << 20;
+
+std::atomic<long long> ScratchArena::allocationCount(0);
+
+// ets_key_per_instance makes local() a native TLS lookup instead of a hash probe
+static tbb::enumerable_thread_specific<ScratchArena, tbb::cache_aligned_allocator<ScratchArena>, tbb::ets_key_per_instance> arenas;
+
+ScratchArena& ScratchArena::local()
+{
+    return arenas.local();
+}
+
+long long ScratchArena::get_allocation_count()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+float* ScratchArena::allocate(size_t count)
+{
+    // keep every buffer on its own cache line
+    count = (count + 15) & ~(size_t)15;
+
+    while (chunkIndex < chunks.size())
+    {
+        Chunk& chunk = chunks[chunkIndex];
+        if (offset + count <= chunk.size())
+        {
+            float* buffer = chunk.data() + offset;
+            offset += count;
+            return buffer;
+        }
+        chunkIndex++;
+        offset = 0;
+    }
+
+    return allocate_chunk(count);
+}
+
+float* ScratchArena::allocate_chunk(size_t count)
+{
+    chunks.emplace_back(max(count, CHUNK_SIZE));
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+    chunkIndex = chunks.size() - 1;
+    offset = count;
+    return chunks[chunkIndex].data();
+}
+
+ScratchArena::Mark ScratchArena::get_mark()
+{
+    return { chunkIndex, offset };
+}
+
+void ScratchArena::release(Mark mark)
+{
+    chunkIndex = mark.chunkIndex;
+    offset = mark.offset;
+}
@@ -0,0 +1,74 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <tbb/cache_aligned_allocator.h>
+using std::size_t;
+using std::vector;
+
+// Per-thread stack of float buffers used by the tree traversals in place of
+// temporary vectors. Buffers are released in LIFO order through ScratchFrame.
+// This stays correct when a thread runs a stolen task inside
+// tbb::task_group::wait(): the stolen task is nested inside the waiting
+// frame and releases everything it took before wait() returns.
+//
+// Memory is taken from the heap in chunks that are kept for the lifetime of
+// the thread, so once every thread has seen its deepest traversal no more
+// heap allocations happen. get_allocation_count() exposes the number of
+// chunk allocations so this can be checked.
+class ScratchArena
+{
+    private:
+        typedef vector<float, tbb::cache_aligned_allocator<float>> Chunk;
+
+        vector<Chunk> chunks;
+        size_t chunkIndex = 0;
+        size_t offset = 0;
+
+        static std::atomic<long long> allocationCount;
+
+        float* allocate_chunk(size_t count);
+
+    public:
+        class Mark
+        {
+            public:
+                size_t chunkIndex;
+                size_t offset;
+        };
+
+        static ScratchArena& local();
+        static long long get_allocation_count();
+
+        float* allocate(size_t count);
+        Mark get_mark();
+        void release(Mark mark);
+};
+
+// Scope guard that returns everything allocated through it to the current
+// thread's arena. It must be destroyed on the thread that created it.
+class ScratchFrame
+{
+    private:
+        ScratchArena& arena;
+        ScratchArena::Mark mark;
+
+    public:
+        ScratchFrame() : arena(ScratchArena::local()), mark(arena.get_mark()) {}
+        ~ScratchFrame() { arena.release(mark); }
+        ScratchFrame(const ScratchFrame&) = delete;
+        ScratchFrame& operator=(const ScratchFrame&) = delete;
+
+        float* allocate(size_t count) { return arena.allocate(count); }
+
+        // scratch space for non-float bookkeeping (pointers, offsets)
+        template <typename T>
+        T* allocate_array(size_t count)
+        {
+            return reinterpret_cast<T*>(arena.allocate((count * sizeof(T) + sizeof(float) - 1) / sizeof(float)));
+        }
+};
+
+#endif
@@ -21,11 +21,13 @@ ShowdownTask::ShowdownTask(shared_ptr<RangeManager> rangeManager,
 }
 
 void ShowdownTask::run() {
-    vector<Hand>& heroHands    = rangeManager->get_hands(hero, board);
-    vector<Hand>& villainHands = rangeManager->get_hands(villain, board);
+    const int boardIndex = RangeManager::get_board_index(board);
 
-    const int numHeroHands    = static_cast<int>(heroHands.size());
-    const int numVillainHands = static_cast<int>(villainHands.size());
+    Hand* heroHands    = rangeManager->get_hands(hero, boardIndex);
+    Hand* villainHands = rangeManager->get_hands(villain, boardIndex);
+
+    const int numHeroHands    = rangeManager->get_num_hands(hero, boardIndex);
+    const int numVillainHands = rangeManager->get_num_hands(villain, boardIndex);
 
     vector<float> utilities(numHeroHands, 0.0f);
     const float value = node->value;
@@ -0,0 +1,191 @@
+#include "SimultaneousCfrTask.h"
+#include "CfrTask.h"
+#include "ScratchArena.h"
+#include <algorithm>
+
+using std::shared_ptr;
+using std::fill;
+
+SimultaneousCfrTask::SimultaneousCfrTask(shared_ptr<RangeManager> rangeManager,
+                                         float* const results[2],
+                                         GameTree* tree,
+                                         NodeRef node,
+                                         const float* const reachProbs[2],
+                                         uint8_t board[5],
+                                         int boardIndex,
+                                         int iterationCount)
+{
+    this->rangeManager = rangeManager;
+    this->tree = tree;
+    this->node = node;
+    for (int player = 0; player < 2; player++) {
+        this->results[player] = results[player];
+        this->reachProbs[player] = reachProbs[player];
+    }
+    for (int i = 0; i < 5; i++)
+        this->board[i] = board[i];
+    this->boardIndex = boardIndex;
+    this->iterationCount = iterationCount;
+}
+
+// Terminal utilities don't depend on the traversal mode, so each player
+// whose villain still has reach gets those of the alternating CfrTask.
+void SimultaneousCfrTask::terminal_utility()
+{
+    for (int hero = 1; hero <= 2; hero++) {
+        const int villain = hero ^ 1 ^ 2;
+        if (reachProbs[villain - 1]) {
+            CfrTask task(rangeManager, results[hero - 1], tree, node, hero, villain, reachProbs[villain - 1],
+                         board, boardIndex, iterationCount);
+            task.run();
+        } else {
+            fill(results[hero - 1], results[hero - 1] + rangeManager->get_num_hands(hero, boardIndex), 0.0f);
+        }
+    }
+}
+
+template <>
+void SimultaneousCfrTask::visit<NodeKind::ALLIN>(TerminalNode&)
+{
+    terminal_utility();
+}
+
+template <>
+void SimultaneousCfrTask::visit<NodeKind::UNCONTESTED>(TerminalNode&)
+{
+    terminal_utility();
+}
+
+template <>
+void SimultaneousCfrTask::visit<NodeKind::SHOWDOWN>(TerminalNode&)
+{
+    terminal_utility();
+}
+
+template <>
+void SimultaneousCfrTask::visit<NodeKind::CHANCE>(ChanceNode& node)
+{
+    chance_node_utility(&node);
+}
+
+template <>
+void SimultaneousCfrTask::visit<NodeKind::ACTION>(ActionNode& node)
+{
+    ActionNode* actionNode = &node;
+    const int numActions = actionNode->numActions;
+
+    // the acting player and the other one
+    const int p = actionNode->player - 1;
+    const int q = 1 - p;
+    const int numHands[2] = { rangeManager->get_num_hands(1, boardIndex), rangeManager->get_num_hands(2, boardIndex) };
+
+    ScratchFrame frame;
+    float* actionResults[2] = { frame.allocate(numActions * numHands[0]), frame.allocate(numActions * numHands[1]) };
+
+    // per-action reach probs of the acting player and its strategy sum
+    // update, fused; the other player's reach passes through unchanged
+    const float** actionReachProbs = frame.allocate_array<const float*>(numActions);
+    float* actionReach = nullptr;
+    if (reachProbs[p]) {
+        actionReach = frame.allocate(numActions * numHands[p]);
+        actionNode->update_strategySum(reachProbs[p], actionReach, iterationCount);
+    }
+    for (int action = 0; action < numActions; ++action) {
+        actionReachProbs[action] = nullptr;
+        if (actionReach && has_reach(actionReach + action * numHands[p], numHands[p]))
+            actionReachProbs[action] = actionReach + action * numHands[p];
+    }
+
+    for_each_child(tree, node, numActions, [&](int action) {
+        float* childResults[2] = { actionResults[0] + action * numHands[0], actionResults[1] + action * numHands[1] };
+        const float* childReachProbs[2];
+        childReachProbs[p] = actionReachProbs[action];
+        childReachProbs[q] = reachProbs[q];
+
+        if (!childReachProbs[0] && !childReachProbs[1]) {
+            fill(childResults[0], childResults[0] + numHands[0], 0.0f);
+            fill(childResults[1], childResults[1] + numHands[1], 0.0f);
+            return;
+        }
+
+        SimultaneousCfrTask sub(rangeManager, childResults, tree, tree->get_child(*actionNode, action),
+                                childReachProbs, board, boardIndex, iterationCount);
+        sub.run();
+    });
+
+    // the acting player's utility under the current strategy and its regret
+    // update, fused; the regrets haven't changed since the strategy sum
+    // update, so neither has the strategy
+    actionNode->update_regretSum(actionResults[p], results[p], iterationCount);
+
+    // the other player's utilities are already weighted by the acting
+    // player's strategy through the reach the children got
+    float* utilities = results[q];
+    fill(utilities, utilities + numHands[q], 0.0f);
+    for (int action = 0; action < numActions; ++action) {
+        const float* su = actionResults[q] + action * numHands[q];
+        for (int h = 0; h < numHands[q]; ++h)
+            utilities[h] += su[h];
+    }
+}
+
+void SimultaneousCfrTask::run()
+{
+    dispatch(tree, node, *this);
+}
+
+void SimultaneousCfrTask::chance_node_utility(ChanceNode* node)
+{
+    ChanceNodeChild* children = tree->get_children(*node);
+    const int childCount = node->childCount;
+
+    ScratchFrame frame;
+    float** childResults = frame.allocate_array<float*>(2 * childCount);
+    const float** childReachProbs = frame.allocate_array<const float*>(2 * childCount);
+    int* boardIndices = frame.allocate_array<int>(childCount);
+
+    // precompute per-child reach probs of both players
+    for (int i = 0; i < childCount; ++i) {
+        uint8_t nb[5];
+        for (int j = 0; j < 5; ++j) nb[j] = board[j];
+
+        const uint8_t card = children[i].card;
+        if (board[3] == 52) nb[3] = card; else nb[4] = card;
+
+        boardIndices[i] = RangeManager::get_board_index(nb);
+        for (int player = 1; player <= 2; ++player) {
+            const int numChildHands = rangeManager->get_num_hands(player, boardIndices[i]);
+            childResults[2 * i + player - 1] = frame.allocate(numChildHands);
+            childReachProbs[2 * i + player - 1] = nullptr;
+            if (!reachProbs[player - 1])
+                continue;
+
+            float* reach = frame.allocate(numChildHands);
+            rangeManager->get_reach_probs(player, boardIndices[i], reachProbs[player - 1], reach);
+            if (has_reach(reach, numChildHands))
+                childReachProbs[2 * i + player - 1] = reach;
+        }
+    }
+
+    for_each_child(tree, *node, childCount, [&](int i) {
+        if (!childReachProbs[2 * i] && !childReachProbs[2 * i + 1]) {
+            for (int player = 1; player <= 2; ++player)
+                fill(childResults[2 * i + player - 1], childResults[2 * i + player - 1] + rangeManager->get_num_hands(player, boardIndices[i]), 0.0f);
+            return;
+        }
+
+        uint8_t nb[5];
+        for (int j = 0; j < 5; ++j) nb[j] = board[j];
+
+        const uint8_t card = children[i].card;
+        if (board[3] == 52) nb[3] = card; else nb[4] = card;
+
+        SimultaneousCfrTask sub(rangeManager, childResults + 2 * i, tree, children[i].node,
+                                childReachProbs + 2 * i, nb, boardIndices[i], iterationCount);
+        sub.run();
+    });
+
+    for (int player = 1; player <= 2; ++player)
+        combine_chance_results(tree, *rangeManager, *node, player, board, boardIndex, boardIndices,
+                               childResults + player - 1, 2, results[player - 1]);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "RangeManager.h"
+#include "GameTree.h"
+#include "NodeRef.h"
+#include "TreeTraversal.h"
+#include "ActionNode.h"
+#include "ChanceNode.h"
+#include "TerminalNode.h"
+
+// One cfr iteration for both players in a single traversal. Every action
+// node gets its strategy sum update before its children and its regret
+// update after them, both from the strategy of the regrets at the start of
+// the iteration, so each node's current strategy is computed once per
+// iteration instead of once per alternating pass. Arrays of two are indexed
+// by player - 1.
+//
+// Buffers passed between tasks are borrowed from the per-thread ScratchArena.
+// A task writes one utility per hand of each player on its board to
+// results, which are owned by the parent. A player without reach left in a
+// subtree gets nullptr reach probs there, and the other player's utilities
+// are 0.
+class SimultaneousCfrTask {
+public:
+    SimultaneousCfrTask(std::shared_ptr<RangeManager> rangeManager,
+                        float* const results[2],
+                        GameTree* tree,
+                        NodeRef node,
+                        const float* const reachProbs[2],
+                        uint8_t board[5],
+                        int boardIndex,
+                        int iterationCount);
+
+    void run();
+
+    // per node kind handlers, called by dispatch()
+    template <NodeKind kind>
+    void visit(typename NodeOf<kind>::type& node);
+
+private:
+    std::shared_ptr<RangeManager> rangeManager;
+    float* results[2];
+    GameTree* tree;
+    NodeRef node;
+    const float* reachProbs[2];
+    uint8_t board[5]{};
+    int boardIndex{0};
+    int iterationCount{0};
+
+    // helpers
+    void terminal_utility();
+    void chance_node_utility(ChanceNode* node);
+};
@@ -4,24 +4,27 @@
 #include "StreetEnum.h"
 #include "PlayerState.h"
 #include "Action.h"
-#include <memory>
-using std::unique_ptr;
+#include <stdint.h>
 
+// Betting state while the tree is built. Both players are stored inline
+// and current/lastToAct are player ids, so a State is trivially copyable
+// and the builder keeps its copies on the stack.
 class State
 {
+    private:
+        PlayerState& get_player(int id);
+
     public:
         Street street;
         int potSize;
 		uint8_t board[5];
-        unique_ptr<PlayerState> p1;
-        unique_ptr<PlayerState> p2;
-        PlayerState* current;
-        PlayerState* lastToAct;
+        PlayerState p1;
+        PlayerState p2;
+        int current;
+        int lastToAct;
         int minimumRaiseSize;
         int minimumBetSize;
         
-        State();
-        State(State& state);
         int get_highest_wager();
         int get_call_amount();
         bool is_uncontested();
@@ -37,4 +40,4 @@ class State
         int get_current_id();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,12 @@
+#ifndef STOP_REASON_ENUM_H
+#define STOP_REASON_ENUM_H
+
+// Why Trainer::train returned
+enum class StopReason
+{
+	TARGET_REACHED,
+	TIME_BUDGET,
+	ITERATION_CAP
+};
+
+#endif
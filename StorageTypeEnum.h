@@ -0,0 +1,19 @@
+#ifndef STORAGE_TYPE_ENUM_H
+#define STORAGE_TYPE_ENUM_H
+
+#include <stdint.h>
+
+// Element type of the regretSum and strategySum blocks in GameTree::storage.
+// The 16-bit types halve the memory of a tree. FLOAT16 and INT16 store each
+// block relative to a scale kept in front of the node's blocks, so the
+// largest value of a block uses the whole range of the type. BFLOAT16 has
+// the exponent range of a float and needs no scale.
+enum class StorageType : uint8_t
+{
+	FLOAT32,
+	FLOAT16,
+	BFLOAT16,
+	INT16
+};
+
+#endif
@@ -0,0 +1,25 @@
+#include "StrategySnapshot.h"
+#include <tbb/parallel_for.h>
+
+void StrategySnapshot::take(GameTree* tree, int iteration)
+{
+    this->iteration = iteration;
+
+    vector<ActionNode>& actionNodes = tree->actionNodes;
+    if (offsets.size() != actionNodes.size())
+    {
+        offsets.resize(actionNodes.size());
+        size_t size = 0;
+        for (size_t i = 0; i < actionNodes.size(); i++)
+        {
+            offsets[i] = size;
+            size += (size_t)actionNodes[i].numHands * actionNodes[i].numActions;
+        }
+        strategies.resize(size);
+    }
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, actionNodes.size()), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t i = range.begin(); i != range.end(); i++)
+            actionNodes[i].get_average_strategy(&strategies[offsets[i]]);
+    });
+}
@@ -0,0 +1,33 @@
+#ifndef STRATEGY_SNAPSHOT_H
+#define STRATEGY_SNAPSHOT_H
+
+#include "GameTree.h"
+#include <cstddef>
+#include <vector>
+using std::vector;
+using std::size_t;
+
+// The normalized average strategy of every action node at one iteration,
+// laid out like GameTree::actionNodes, so a best response can run on it
+// while training keeps updating the tree.
+class StrategySnapshot
+{
+    private:
+        vector<float> strategies;
+        vector<size_t> offsets;
+
+    public:
+        int iteration = 0;
+
+        // Normalizes every node in parallel on the calling arena. Training
+        // must not run at the same time.
+        void take(GameTree* tree, int iteration);
+
+        // numHands*numActions values, like ActionNode::get_average_strategy
+        const float* get_strategy(int actionNodeIndex) const
+        {
+            return &strategies[offsets[actionNodeIndex]];
+        }
+};
+
+#endif
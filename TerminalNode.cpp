@@ -1,7 +1,6 @@
 #include "TerminalNode.h"
 
-TerminalNode::TerminalNode(Node* parent, TerminalNodeType type)
+TerminalNode::TerminalNode(TerminalNodeType type)
 {
-    this->parent = parent;
     this->type = type;
-}
\ No newline at end of file
+}
@@ -3,8 +3,6 @@
 
 #include "TerminalNodeTypeEnum.h"
 #include "Node.h"
-#include <memory>
-using std::unique_ptr;
 
 class TerminalNode : public Node
 {
@@ -12,9 +10,8 @@ class TerminalNode : public Node
         TerminalNodeType type;
         int lastToAct;
         float value;
-        int board[5];
 
-        TerminalNode(Node* parent, TerminalNodeType type);
+        TerminalNode(TerminalNodeType type);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,8 +4,16 @@
 #include "ChanceNodeTypeEnum.h"
 #include "TerminalNodeTypeEnum.h"
 #include "CfrTask.h"
+#include "SimultaneousCfrTask.h"
+#include "ScratchArena.h"
+#include "Checkpoint.h"
+#include "ExploitabilityEvaluator.h"
 #include <chrono>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <utility>
 #include <tbb/task_group.h>
 
 using std::cout;
@@ -20,37 +28,250 @@ Trainer::Trainer(std::shared_ptr<RangeManager> rangeManager, uint8_t initialBoar
     for (int i = 0; i < 5; i++) this->initialBoard[i] = initialBoard[i];
     this->initialPot = initialPot;
     this->inPositionPlayer = inPositionPlayer;
+
+    p1InitialReachProbs = rangeManager->get_initial_reach_probs(1);
+    p2InitialReachProbs = rangeManager->get_initial_reach_probs(2);
+    p1Result.resize(rangeManager->get_starting_hands(1).size());
+    p2Result.resize(rangeManager->get_starting_hands(2).size());
 }
 
-void Trainer::train(Node* root, int numIterations)
+TrainingResult Trainer::train(GameTree* tree, int numIterations)
 {
-    br = make_unique<BestResponse>(rangeManager, root, initialBoard, initialPot, inPositionPlayer);
-    br->print_exploitability();
+    // the time budget counts from here, the reported times from after the
+    // first best response as before
+    const auto start = chronoClock::now();
+
+    br = make_unique<BestResponse>(rangeManager, tree, initialBoard, initialPot, inPositionPlayer);
+    float exploitability = br->print_exploitability();
+    double bestResponseSeconds = sec(chronoClock::now() - start).count();
     cout << '\n';
 
+    unique_ptr<CheckpointWriter> checkpointWriter;
+    if (!settings.checkpointPath.empty())
+        checkpointWriter = make_unique<CheckpointWriter>(settings.checkpointPath, tree->get_fingerprint());
+    int checkpointIteration = iteration;
+
+    // background results, taken over by the training loop between iterations
+    std::mutex asyncMutex;
+    vector<std::pair<int, float>> asyncResults;
+    unique_ptr<ExploitabilityEvaluator> evaluator;
+    if (settings.asyncExploitability)
+        evaluator = make_unique<ExploitabilityEvaluator>(rangeManager, tree, initialBoard, initialPot, inPositionPlayer,
+            settings.exploitabilityThreads, [&](int resultIteration, float resultExploitability) {
+                {
+                    std::lock_guard<std::mutex> lock(asyncMutex);
+                    asyncResults.emplace_back(resultIteration, resultExploitability);
+                }
+                if (settings.exploitabilityCallback)
+                    settings.exploitabilityCallback(resultIteration, resultExploitability);
+            });
+
+    TrainingResult result;
+    result.stopReason = StopReason::ITERATION_CAP;
+
+    // the iteration exploitability belongs to, and the check before it
+    int checkIteration = iteration;
+    int previousCheckIteration = 0;
+    float previousExploitability = 0;
+    int nextCheckIteration = iteration + get_check_gap(iteration, exploitability, 0, 0, 0, bestResponseSeconds);
+
     const auto before = chronoClock::now();
+    double cfrSeconds = 0;
+    int iterationsDone = 0;
+
+    auto print_progress = [&](int i) {
+        const sec duration = chronoClock::now() - before;
+        cout << i << " cfr iterations took: " << duration.count() << "s\n";
+        cout << "Scratch chunk allocations: " << ScratchArena::get_allocation_count() << "\n";
+        if (settings.pruning)
+            print_pruning_stats();
+        cout << '\n';
+    };
 
-    for (int i = 1; i <= numIterations; i++) {
-        cfr(1, 2, root, i);
-        cfr(2, 1, root, i);
+    // background results are used like synchronous ones, just later
+    auto take_async_results = [&]() {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        for (const std::pair<int, float>& asyncResult : asyncResults) {
+            previousCheckIteration = checkIteration;
+            previousExploitability = exploitability;
+            checkIteration = asyncResult.first;
+            exploitability = asyncResult.second;
+            cout << "Exploitability: " << exploitability << "% at iteration " << checkIteration << "\n";
+            print_progress(iteration);
 
-        if (i % 25 == 0) {
-            br->print_exploitability();
-            const sec duration = chronoClock::now() - before;
-            cout << i << " cfr iterations took: " << duration.count() << "s\n\n";
+            nextCheckIteration = std::max(iteration + 1, checkIteration + get_check_gap(checkIteration, exploitability,
+                previousCheckIteration, previousExploitability, cfrSeconds / std::max(iterationsDone, 1), bestResponseSeconds));
         }
+        asyncResults.clear();
+    };
+
+    for (int i = iteration + 1; i <= numIterations; i++) {
+        if (evaluator)
+            take_async_results();
+
+        if (settings.targetExploitability > 0 && exploitability <= settings.targetExploitability) {
+            result.stopReason = StopReason::TARGET_REACHED;
+            break;
+        }
+
+        // leave time for this iteration and the final best response
+        const double iterationSeconds = iterationsDone ? cfrSeconds / iterationsDone : 0;
+        if (settings.timeBudget > 0
+            && sec(chronoClock::now() - start).count() + iterationSeconds + bestResponseSeconds > settings.timeBudget) {
+            result.stopReason = StopReason::TIME_BUDGET;
+            break;
+        }
+
+        const auto iterationStart = chronoClock::now();
+        cfr_iteration(tree, i);
+        iteration = i;
+        cfrSeconds += sec(chronoClock::now() - iterationStart).count();
+        iterationsDone++;
+
+        // while the previous checkpoint is still being written the next
+        // one is retried every iteration instead of waiting for it
+        if (checkpointWriter && i - checkpointIteration >= settings.checkpointInterval
+            && checkpointWriter->save(tree->storage.data(), tree->storage.size(), i))
+            checkpointIteration = i;
+
+        // a snapshot can't be taken while the previous one is evaluated, so
+        // it is retried every iteration until its result has arrived
+        if (evaluator) {
+            if (i >= nextCheckIteration && evaluator->evaluate(tree, i))
+                nextCheckIteration = numIterations + 1;
+        } else if (i == nextCheckIteration) {
+            const auto bestResponseStart = chronoClock::now();
+            previousCheckIteration = checkIteration;
+            previousExploitability = exploitability;
+            exploitability = br->print_exploitability();
+            checkIteration = i;
+            bestResponseSeconds = sec(chronoClock::now() - bestResponseStart).count();
+            print_progress(i);
+
+            nextCheckIteration = i + get_check_gap(i, exploitability, previousCheckIteration, previousExploitability,
+                                                   cfrSeconds / iterationsDone, bestResponseSeconds);
+        }
+    }
+
+    // the result always reports the final strategy, the stop reason stays
+    // the one the loop stopped for
+    if (evaluator) {
+        evaluator->wait();
+        take_async_results();
+    }
+    if (checkIteration < iteration)
+        exploitability = br->print_exploitability();
+
+    if (checkpointWriter) {
+        checkpointWriter->wait();
+        if (checkpointIteration < iteration)
+            checkpointWriter->save(tree->storage.data(), tree->storage.size(), iteration);
+        checkpointWriter->wait();
+    }
+
+    static const char* stopReasonNames[] = { "target reached", "time budget", "iteration cap" };
+    result.iterations = iteration;
+    result.exploitability = exploitability;
+    result.seconds = sec(chronoClock::now() - start).count();
+    cout << "Stopped after " << result.iterations << " iterations and " << result.seconds << "s ("
+         << stopReasonNames[(int)result.stopReason] << "), exploitability " << result.exploitability << "%\n";
+
+    return result;
+}
+
+// Iterations from a best response at checkIteration to the next one.
+// Without a target they come at multiples of 25. With one, the last two
+// checks are fitted with exploitability = c * t^-k and the next check goes
+// where the fit meets the target: sparse while far away, dense close to it.
+// The gap at most doubles the iteration count, so a poor early fit costs
+// little, and is long enough that best responses take at most a quarter of
+// the time.
+int Trainer::get_check_gap(int checkIteration, float exploitability, int previousCheckIteration, float previousExploitability,
+                           double iterationSeconds, double bestResponseSeconds)
+{
+    if (settings.targetExploitability <= 0)
+        return 25 - checkIteration % 25;
+
+    if (checkIteration == 0)
+        return 10;
+
+    int gap = checkIteration;
+    if (previousCheckIteration > 0 && exploitability < previousExploitability) {
+        double k = std::log(previousExploitability / exploitability) / std::log((double)checkIteration / previousCheckIteration);
+        double targetIteration = checkIteration * std::pow(exploitability / settings.targetExploitability, 1 / k);
+        gap = (int)std::min<double>(std::ceil(targetIteration - checkIteration), gap);
     }
+
+    if (iterationSeconds > 0)
+        gap = std::max<double>(gap, std::ceil(3 * bestResponseSeconds / iterationSeconds));
+
+    return std::max(gap, 1);
+}
+
+// Restores the regrets, strategies and iteration count of a checkpoint
+// written by train() for the same tree.
+void Trainer::resume(GameTree* tree, string checkpointPath)
+{
+    iteration = Checkpoint::read(checkpointPath, tree);
 }
 
-vector<float> Trainer::cfr(int hero, int villain, Node* root, int iterationCount)
+// Runs cfr iterations without the exploitability reports and returns the
+// average wall time of one iteration in seconds.
+double Trainer::time_iterations(GameTree* tree, int numIterations)
 {
-    vector<float> villainReachProbs = rangeManager->get_initial_reach_probs(villain);
+    const auto before = chronoClock::now();
 
-    vector<float> result;
+    for (int i = 1; i <= numIterations; i++)
+        cfr_iteration(tree, i);
+
+    const sec duration = chronoClock::now() - before;
+    return duration.count() / numIterations;
+}
+
+void Trainer::cfr_iteration(GameTree* tree, int iterationCount)
+{
+    if (!settings.simultaneousUpdates) {
+        cfr(1, 2, tree, iterationCount);
+        cfr(2, 1, tree, iterationCount);
+        return;
+    }
+
+    float* const results[2] = { p1Result.data(), p2Result.data() };
+    const float* const reachProbs[2] = { p1InitialReachProbs.data(), p2InitialReachProbs.data() };
     tbb::task_group tg;
-    CfrTask task(rangeManager, &result, root, hero, villain, &villainReachProbs, initialBoard, iterationCount);
+    SimultaneousCfrTask task(rangeManager, results, tree, tree->root, reachProbs, initialBoard,
+                             RangeManager::get_board_index(initialBoard), iterationCount);
+    tg.run([&]{ task.run(); });
+    tg.wait();
+}
+
+vector<float>& Trainer::cfr(int hero, int villain, GameTree* tree, int iterationCount)
+{
+    vector<float>& villainReachProbs = (villain == 1) ? p1InitialReachProbs : p2InitialReachProbs;
+    vector<float>& result = (hero == 1) ? p1Result : p2Result;
+
+    // an interval of 0 or less never forces a full traversal
+    const bool prune = settings.pruning && iterationCount > settings.pruningStart
+        && (settings.fullTraversalInterval <= 0 || iterationCount % settings.fullTraversalInterval != 0);
+    traversalCost += tree->get_subtree_cost(tree->root);
+
+    tbb::task_group tg;
+    CfrTask task(rangeManager, result.data(), tree, tree->root, hero, villain, villainReachProbs.data(), initialBoard,
+                 RangeManager::get_board_index(initialBoard), iterationCount, prune ? &pruningStats : nullptr);
     tg.run([&]{ task.run(); });
     tg.wait();
 
     return result;
 }
+
+// Simultaneous updates never prune, there is nothing to report for them.
+void Trainer::print_pruning_stats()
+{
+    if (traversalCost == 0)
+        return;
+
+    const uint64_t prunedCost = pruningStats.prunedCost.exchange(0);
+    cout << "Pruned " << pruningStats.prunedSubtrees.exchange(0) << " subtrees, "
+         << 100 * prunedCost / traversalCost << "% of the work\n";
+    traversalCost = 0;
+}
@@ -1,11 +1,12 @@
 #ifndef TRAINER_H
 #define TRAINER_H
 
-#include "Node.h"
+#include "GameTree.h"
 #include "RangeManager.h"
-#include "ChanceNode.h"
-#include "TerminalNode.h"
 #include "BestResponse.h"
+#include "TrainerSettings.h"
+#include "CfrTask.h"
+#include "StopReasonEnum.h"
 #include <memory>
 #include <array>
 #include <vector>
@@ -13,6 +14,17 @@ using std::vector;
 using std::unique_ptr;
 using std::shared_ptr;
 
+class TrainingResult
+{
+    public:
+        StopReason stopReason;
+        int iterations;
+
+        // of the final strategy, in percent of the pot
+        float exploitability;
+        double seconds;
+};
+
 class Trainer
 {
     private:
@@ -22,11 +34,35 @@ class Trainer
         int inPositionPlayer;
 		uint8_t initialBoard[5];
 
-		vector<float> cfr(int hero, int villain, Node *root, int iterationCount);
+		// root buffers, kept across iterations
+		vector<float> p1InitialReachProbs;
+		vector<float> p2InitialReachProbs;
+		vector<float> p1Result;
+		vector<float> p2Result;
+
+		// iterations done so far, restored by resume()
+		int iteration = 0;
+
+		// pruned work since the last report, and the work of the
+		// iterations since then with nothing pruned
+		PruningStats pruningStats;
+		double traversalCost = 0;
+
+		void cfr_iteration(GameTree* tree, int iterationCount);
+		vector<float>& cfr(int hero, int villain, GameTree* tree, int iterationCount);
+		void print_pruning_stats();
+		int get_check_gap(int checkIteration, float exploitability, int previousCheckIteration, float previousExploitability,
+			double iterationSeconds, double bestResponseSeconds);
 
     public:
+        TrainerSettings settings;
+
         Trainer(shared_ptr<RangeManager> rangeManager, uint8_t initialBoard[5], int initialPot, int inPositionPlayer);
-        void train(Node* root, int numIterations);
+        // trains until numIterations iterations are done in total, or
+        // earlier when settings has a target or time budget
+        TrainingResult train(GameTree* tree, int numIterations);
+        void resume(GameTree* tree, string checkpointPath);
+        double time_iterations(GameTree* tree, int numIterations);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef TRAINER_SETTINGS_H
+#define TRAINER_SETTINGS_H
+
+#include <string>
+#include <functional>
+using std::string;
+
+class TrainerSettings
+{
+    public:
+        // A checkpoint is written every checkpointInterval iterations when
+        // checkpointPath is set. See Checkpoint.h for the format.
+        string checkpointPath;
+        int checkpointInterval = 100;
+
+        // Both players are updated in one traversal per iteration instead
+        // of one alternating pass each. Every node then computes its current
+        // strategy once per iteration, but the second player no longer
+        // responds to the first one's update of the same iteration, so more
+        // iterations are needed for the same exploitability.
+        bool simultaneousUpdates = false;
+
+        // Regret based pruning: after pruningStart iterations, hero actions
+        // the current strategy never plays aren't traversed, except in every
+        // fullTraversalInterval-th iteration. Those full traversals refresh
+        // the regrets of pruned actions and the strategy sums below them, an
+        // interval of 0 or less leaves them out. Only the alternating passes
+        // prune, pruning is ignored with simultaneousUpdates.
+        bool pruning = false;
+        int pruningStart = 25;
+        int fullTraversalInterval = 10;
+
+        // train() stops once the exploitability, in percent of the pot, is
+        // at most targetExploitability, or before an iteration and the final
+        // best response would take it past timeBudget seconds. 0 turns
+        // either off. Best responses are scheduled by how fast the
+        // exploitability falls when there is a target, every 25 iterations
+        // otherwise.
+        float targetExploitability = 0;
+        double timeBudget = 0;
+
+        // Best responses run on a snapshot of the average strategy in the
+        // background, on at most exploitabilityThreads threads, while
+        // training continues. Stopping decisions then use the latest result
+        // that has arrived. exploitabilityCallback gets every result with
+        // its iteration, on the background thread.
+        bool asyncExploitability = false;
+        int exploitabilityThreads = 1;
+        std::function<void(int iteration, float exploitability)> exploitabilityCallback;
+};
+
+#endif
@@ -3,9 +3,11 @@
 
 #include "BetSettings.h"
 #include <stdint.h>
+#include <cstddef>
 #include "StreetEnum.h"
 #include <memory>
 #include "RangeManager.h"
+#include "StorageTypeEnum.h"
 using std::shared_ptr;
 using std::unique_ptr;
 
@@ -26,6 +28,22 @@ class TreeBuildSettings
         int minimumBetSize;
         float allinThreshold;
 
+        // Subtrees with a lower estimated cost (Node::subtreeCost) are
+        // traversed serially instead of spawning a task per child.
+        float parallelCostThreshold = 200000;
+
+        // Build a single subtree per set of suit isomorphic turn or river
+        // cards. Only suit permutations that leave both starting ranges and
+        // everything dealt so far unchanged are used.
+        bool suitIsomorphism = true;
+
+        // element type of the regret and strategy sums, see StorageTypeEnum.h
+        StorageType storageType = StorageType::FLOAT32;
+
+        // Bytes of GameTree::estimate's working set GameTree::build may
+        // allocate, 0 for no limit
+        size_t memoryBudget = 0;
+
         TreeBuildSettings(
 			shared_ptr<RangeManager> rangeManager,
 			int inPositionPlayerId,
@@ -0,0 +1,18 @@
+#include "TreeEstimate.h"
+#include <iostream>
+using std::cout;
+
+void TreeEstimate::print()
+{
+    cout << "Flop action node count: " << flopActionNodes << "\n";
+    cout << "Turn action node count: " << turnActionNodes << "\n";
+    cout << "River action node count: " << riverActionNodes << "\n";
+    cout << "Chance node count: " << chanceNodes << "\n";
+    cout << "Uncontested node count: " << uncontestedNodes << "\n";
+    cout << "Allin node count: " << allinNodes << "\n";
+    cout << "Showdown node count: " << showdownNodes << "\n";
+    cout << "Tree structure: " << structureBytes / 1024 << " KB\n";
+    cout << "Regret/strategy storage: " << storageBytes / (1024 * 1024) << " MB\n";
+    cout << "Allin equity tables: " << allinEquityBytes / (1024 * 1024) << " MB\n";
+    cout << "Per iteration working set: " << get_working_set() / (1024 * 1024) << " MB\n";
+}
@@ -0,0 +1,41 @@
+#ifndef TREE_ESTIMATE_H
+#define TREE_ESTIMATE_H
+
+#include <cstddef>
+#include <vector>
+using std::vector;
+using std::size_t;
+
+// What GameTree::build would allocate for the current settings, counted
+// without building the tree. The counts match the ones build prints.
+class TreeEstimate
+{
+    public:
+        size_t flopActionNodes = 0;
+        size_t turnActionNodes = 0;
+        size_t riverActionNodes = 0;
+        size_t chanceNodes = 0;
+        size_t allinNodes = 0;
+        size_t showdownNodes = 0;
+        size_t uncontestedNodes = 0;
+
+        // GameTree::storage, GameTree::get_structure_size and the allin
+        // equity tables built into the RangeManager
+        size_t storageBytes = 0;
+        size_t structureBytes = 0;
+        size_t allinEquityBytes = 0;
+
+        // boards whose allin equity table is already counted, by board index
+        vector<bool> allinBoards;
+
+        // Every iteration reads the whole structure and equity tables and
+        // reads and writes every storage block, once per traversal.
+        inline size_t get_working_set()
+        {
+            return storageBytes + structureBytes + allinEquityBytes;
+        }
+
+        void print();
+};
+
+#endif
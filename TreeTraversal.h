@@ -0,0 +1,205 @@
+#ifndef TREE_TRAVERSAL_H
+#define TREE_TRAVERSAL_H
+
+#include "GameTree.h"
+#include "RangeManager.h"
+#include "NodeRef.h"
+#include "NodeKindEnum.h"
+#include "Hand.h"
+#include "ScratchArena.h"
+#include <algorithm>
+#include <cstring>
+#include <tbb/task_group.h>
+
+// Arena record type that backs each node kind.
+template <NodeKind kind>
+struct NodeOf
+{
+    typedef TerminalNode type;
+};
+
+template <>
+struct NodeOf<NodeKind::ACTION>
+{
+    typedef ActionNode type;
+};
+
+template <>
+struct NodeOf<NodeKind::CHANCE>
+{
+    typedef ChanceNode type;
+};
+
+// Resolves a NodeRef to its arena record and calls the handler specialized for
+// its kind. A handler provides
+//
+//     template <NodeKind kind> void visit(typename NodeOf<kind>::type& node);
+//
+// so every node kind and terminal subtype gets its own instantiation and the
+// dispatch is a single switch on the tag, without RTTI or virtual calls.
+template <typename Handler>
+inline void dispatch(GameTree* tree, NodeRef node, Handler& handler)
+{
+    switch (node.kind)
+    {
+        case NodeKind::ACTION:
+            handler.template visit<NodeKind::ACTION>(tree->actionNodes[node.index]);
+            break;
+        case NodeKind::CHANCE:
+            handler.template visit<NodeKind::CHANCE>(tree->chanceNodes[node.index]);
+            break;
+        case NodeKind::ALLIN:
+            handler.template visit<NodeKind::ALLIN>(tree->terminalNodes[node.index]);
+            break;
+        case NodeKind::UNCONTESTED:
+            handler.template visit<NodeKind::UNCONTESTED>(tree->terminalNodes[node.index]);
+            break;
+        case NodeKind::SHOWDOWN:
+            handler.template visit<NodeKind::SHOWDOWN>(tree->terminalNodes[node.index]);
+            break;
+    }
+}
+
+// Calls body(i) for every child i of node. Each child gets its own task only
+// when the node's subtree is expensive enough to pay for the spawn and steal
+// overhead; below TreeBuildSettings::parallelCostThreshold the children are
+// walked serially on the calling thread. Child costs never exceed their
+// parent's, so once a traversal goes serial it stays serial.
+template <typename Body>
+inline void for_each_child(GameTree* tree, const Node& node, int count, const Body& body)
+{
+    if (node.subtreeCost < tree->treeBuildSettings->parallelCostThreshold)
+    {
+        for (int i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+
+    tbb::task_group tg;
+    for (int i = 0; i < count; i++)
+        tg.run([&body, i] { body(i); });
+    tg.wait();
+}
+
+// Villain reach summaries. Every utility is linear in the villain reach, so
+// a subtree the villain never reaches has utilities of exactly 0 and isn't
+// traversed. Late in a solve many lines are reached by few villain hands,
+// which the terminal sweeps then visit alone.
+inline bool has_reach(const float* reachProbs, int numHands)
+{
+    for (int i = 0; i < numHands; i++)
+        if (reachProbs[i] != 0)
+            return true;
+    return false;
+}
+
+// Returns the number of hands with reach. When at most half of them have
+// any, hands, reachProbs and numHands are replaced by frame buffers with
+// just those hands, in the same (rank) order.
+inline int compact_reach(const Hand*& hands, const float*& reachProbs, int& numHands, ScratchFrame& frame)
+{
+    int numActiveHands = 0;
+    for (int i = 0; i < numHands; i++)
+        numActiveHands += (reachProbs[i] != 0);
+
+    if (numActiveHands == 0 || numActiveHands > numHands / 2)
+        return numActiveHands;
+
+    Hand* activeHands = frame.allocate_array<Hand>(numActiveHands);
+    float* activeReachProbs = frame.allocate(numActiveHands);
+    int j = 0;
+    for (int i = 0; i < numHands; i++)
+        if (reachProbs[i] != 0)
+        {
+            activeHands[j] = hands[i];
+            activeReachProbs[j++] = reachProbs[i];
+        }
+
+    hands = activeHands;
+    reachProbs = activeReachProbs;
+    numHands = numActiveHands;
+    return numActiveHands;
+}
+
+// Sums one player's child results of a chance node into its utilities on
+// the node's board. childResults[i * stride] holds the results of child i on
+// its own board, mapped back through the reach probs mapping and added once
+// more for each isomorphic card under that card's suit permutation. The sum
+// is divided by the number of cards that can be dealt.
+inline void combine_chance_results(GameTree* tree, RangeManager& rangeManager, ChanceNode& node, int player,
+                                   const uint8_t board[5], int boardIndex, const int* childBoardIndices,
+                                   float* const* childResults, int stride, float* utilities)
+{
+    ChanceNodeChild* children = tree->get_children(node);
+    const int numHands = rangeManager.get_num_hands(player, boardIndex);
+    std::fill(utilities, utilities + numHands, 0.0f);
+
+    for (int i = 0; i < node.childCount; ++i)
+    {
+        const float* subgameUtilities = childResults[i * stride];
+        const int* reachProbsMapping  = rangeManager.get_reach_probs_mapping(player, childBoardIndices[i]);
+        const int numSubgameHands     = rangeManager.get_num_hands(player, childBoardIndices[i]);
+
+        for (int k = 0; k < numSubgameHands; ++k)
+            utilities[reachProbsMapping[k]] += subgameUtilities[k];
+
+        // isomorphic cards give the same results to the permuted hands
+        const uint8_t* isomorphisms = tree->get_isomorphisms(children[i]);
+        for (int j = 0; j < children[i].isomorphismCount; ++j)
+        {
+            const int* suitPermutation = rangeManager.get_suit_permutation(player, boardIndex, isomorphisms[j]);
+            for (int k = 0; k < numSubgameHands; ++k)
+                utilities[suitPermutation[reachProbsMapping[k]]] += subgameUtilities[k];
+        }
+    }
+
+    const int weight = (board[3] == 52) ? 45 : 44;
+    for (int h = 0; h < numHands; ++h)
+        utilities[h] /= weight;
+}
+
+// Hero utilities at an uncontested terminal, shared by the CFR and best
+// response passes: every villain hand that doesn't block the hero hand pays
+// or wins the pot, found with per-card reach sums instead of a pair loop.
+inline void uncontested_utilities(RangeManager& rangeManager, const TerminalNode& node, int hero, int villain,
+                                  const float* villainReachProbs, int boardIndex, float* utilities)
+{
+    const Hand* heroHands    = rangeManager.get_hands(hero, boardIndex);
+    const Hand* villainHands = rangeManager.get_hands(villain, boardIndex);
+
+    int numHeroHands    = rangeManager.get_num_hands(hero, boardIndex);
+    int numVillainHands = rangeManager.get_num_hands(villain, boardIndex);
+
+    // the blocker correction below is indexed like the hero hands, so the
+    // compacted reach probs get their own pointer
+    const float* activeReachProbs = villainReachProbs;
+    ScratchFrame frame;
+    if (compact_reach(villainHands, activeReachProbs, numVillainHands, frame) == 0)
+    {
+        std::fill(utilities, utilities + numHeroHands, 0.0f);
+        return;
+    }
+
+    float villainSum = 0.0f;
+    float villainCardSum[52];
+    std::memset(villainCardSum, 0, sizeof(villainCardSum));
+
+    for (int i = 0; i < numVillainHands; ++i)
+    {
+        villainCardSum[villainHands[i].card1] += activeReachProbs[i];
+        villainCardSum[villainHands[i].card2] += activeReachProbs[i];
+        villainSum += activeReachProbs[i];
+    }
+
+    float value = (hero == node.lastToAct) ? -node.value : node.value;
+
+    for (int i = 0; i < numHeroHands; ++i)
+    {
+        utilities[i] = (villainSum
+            - villainCardSum[heroHands[i].card1]
+            - villainCardSum[heroHands[i].card2]
+            + villainReachProbs[i]) * value;
+    }
+}
+
+#endif
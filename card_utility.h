@@ -2,6 +2,7 @@
 #define CARD_UTILITY_H
 
 #include "Hand.h"
+#include "deck.h"
 #include <string>
 #include <vector>
 using std::vector;
@@ -17,6 +18,16 @@ inline uint8_t card_from_rank_and_suit2(uint8_t rank, uint8_t suit)
 	return (rank - 2) * 4 + suit;
 }
 
+// The 24 permutations of the four suits, SUIT_PERMUTATIONS[p][suit] is the
+// suit that suit is mapped to. Permutation 0 is the identity.
+const int SUIT_PERMUTATION_COUNT = 24;
+extern const uint8_t SUIT_PERMUTATIONS[SUIT_PERMUTATION_COUNT][4];
+
+inline uint8_t permute_suits(uint8_t card, int permutation)
+{
+	return deck_make_card(SUIT_PERMUTATIONS[permutation][deck_get_suit(card)], deck_get_rank(card));
+}
+
 inline bool board_has_turn(uint8_t board[5])
 {
 	return board[3] != 52;
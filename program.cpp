@@ -8,6 +8,15 @@
 #include "RangeManager.h"
 #include <iostream>
 #include "Trainer.h"
+#include <limits>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "RegretKernels.h"
+#include "CfrTask.h"
+#include "SimultaneousCfrTask.h"
 using std::cout;
 using std::move;
 using std::shared_ptr;
@@ -15,6 +24,8 @@ using std::unique_ptr;
 using std::make_unique;
 using std::make_shared;
 using std::vector;
+using chronoClock = std::chrono::steady_clock;
+using sec = std::chrono::duration<double>;
 
 void testTurn2()
 {
@@ -62,12 +73,12 @@ void testTurn2()
 		allinThreshold);
 
 	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
-	unique_ptr<Node> root = gameTree->build();
-	gameTree->print_tree(root.get(), 0);
+	NodeRef root = gameTree->build();
+	gameTree->print_tree(root, 0);
 	cout << '\n';
 
 	unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, initialPotSize, inPositionPlayerId);
-	trainer->train(root.get(), 200);
+	trainer->train(gameTree.get(), 200);
 }
 
 void testTurn3()
@@ -116,12 +127,12 @@ void testTurn3()
 		allinThreshold);
 
 	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
-	unique_ptr<Node> root = gameTree->build();
-	gameTree->print_tree(root.get(), 0);
+	NodeRef root = gameTree->build();
+	gameTree->print_tree(root, 0);
 	cout << '\n';
 
 	unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, initialPotSize, inPositionPlayerId);
-	trainer->train(root.get(), 200);
+	trainer->train(gameTree.get(), 200);
 }
 
 void testRiver()
@@ -170,12 +181,12 @@ void testRiver()
 		allinThreshold);
 
 	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
-	unique_ptr<Node> root = gameTree->build();
-	gameTree->print_tree(root.get(), 0);
+	NodeRef root = gameTree->build();
+	gameTree->print_tree(root, 0);
 	cout << '\n';
 
 	unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, initialPotSize, inPositionPlayerId);
-	trainer->train(root.get(), 1000);
+	trainer->train(gameTree.get(), 1000);
 }
 
 void testTurn()
@@ -232,12 +243,12 @@ void testTurn()
 		allinThreshold);
 
 	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
-	unique_ptr<Node> root = gameTree->build();
-	gameTree->print_tree(root.get(), 0);
+	NodeRef root = gameTree->build();
+	gameTree->print_tree(root, 0);
 	cout << '\n';
 
 	unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, initialPotSize, inPositionPlayerId);
-	trainer->train(root.get(), 200);
+	trainer->train(gameTree.get(), 200);
 }
 
 void testFlop()
@@ -292,12 +303,575 @@ void testFlop()
 		allinThreshold);
 
 	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
-	unique_ptr<Node> root = gameTree->build();
-	gameTree->print_tree(root.get(), 0);
+	NodeRef root = gameTree->build();
+	gameTree->print_tree(root, 0);
 	cout << '\n';
 
 	unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, initialPotSize, inPositionPlayerId);
-	trainer->train(root.get(), 500);
+	trainer->train(gameTree.get(), 500);
+}
+
+// Times cfr iterations on the testTurn spot for a range of
+// parallelCostThreshold values. A threshold of 0 spawns a task for every child
+// and the largest one runs the whole traversal serially; the crossover is
+// where the time per iteration stops improving.
+void benchmarkTaskGranularity()
+{
+	string p1StartingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+	string p2StartingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+
+	int inPositionPlayerId = 2;
+
+	Street initialStreet = Street::TURN;
+	uint8_t initialBoard[5] = { card_from_string("Kd"), card_from_string("Jd"), card_from_string("Td"), card_from_string("5s"), 52 };
+
+	int initialPotSize = 100;
+	int startingStackSize = 1000;
+
+	unique_ptr<BetSettings> p1BetSettings = make_unique<BetSettings>();
+	unique_ptr<BetSettings> p2BetSettings = make_unique<BetSettings>();
+
+	p1BetSettings->turnBetSizes.push_back(0.5f);
+	p1BetSettings->turnBetSizes.push_back(1.0f);
+
+	p1BetSettings->riverBetSizes.push_back(0.25f);
+	p1BetSettings->riverBetSizes.push_back(0.5f);
+	p1BetSettings->riverBetSizes.push_back(1.0f);
+
+	p1BetSettings->turnRaiseSizes.push_back(0.5f);
+	p1BetSettings->riverRaiseSizes.push_back(0.5f);
+
+	p2BetSettings->turnBetSizes.push_back(0.5f);
+	p2BetSettings->turnBetSizes.push_back(1.0f);
+
+	p2BetSettings->riverBetSizes.push_back(0.25f);
+	p2BetSettings->riverBetSizes.push_back(0.5f);
+	p2BetSettings->riverBetSizes.push_back(1.0f);
+
+	p2BetSettings->turnRaiseSizes.push_back(0.5f);
+	p2BetSettings->riverRaiseSizes.push_back(0.5f);
+
+	int minimumBetSize = 10;
+	float allinThreshold = 0.67f;
+
+	shared_ptr<RangeManager> rangeManager = make_shared<RangeManager>(p1StartingHands, p2StartingHands, initialBoard);
+
+	unique_ptr<TreeBuildSettings> treeBuildSettings = make_unique<TreeBuildSettings>(
+		rangeManager,
+		inPositionPlayerId,
+		initialStreet,
+		initialBoard,
+		initialPotSize,
+		startingStackSize,
+		move(p1BetSettings),
+		move(p2BetSettings),
+		minimumBetSize,
+		allinThreshold);
+
+	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
+	NodeRef root = gameTree->build();
+	cout << "Root subtree cost: " << gameTree->get_subtree_cost(root) << "\n\n";
+
+	unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, initialPotSize, inPositionPlayerId);
+
+	// warm up the scratch arenas and the caches
+	trainer->time_iterations(gameTree.get(), 2);
+
+	float thresholds[] = { 0, 1e3f, 1e4f, 1e5f, 2e5f, 1e6f, 1e7f, std::numeric_limits<float>::max() };
+	for (float threshold : thresholds)
+	{
+		gameTree->treeBuildSettings->parallelCostThreshold = threshold;
+		double seconds = trainer->time_iterations(gameTree.get(), 10);
+		cout << "threshold " << threshold << ": " << seconds * 1000 << " ms per iteration\n";
+	}
+}
+
+// Times each regret kernel for every instruction set the CPU supports and
+// checks the vector versions against the scalar one.
+void benchmarkRegretKernels()
+{
+	const int numHands = 1081; // a full river range, not a multiple of any vector width
+	const int repetitions = 20000;
+	int actionCounts[] = { 2, 3, 4, 5, 6, 8, 10 };
+	InstructionSet instructionSets[] = { InstructionSet::SCALAR, InstructionSet::AVX2, InstructionSet::AVX512 };
+	InstructionSet defaultInstructionSet = RegretKernels::get_instruction_set();
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+
+	for (int numActions : actionCounts)
+	{
+		int size = numHands * numActions;
+		vector<float> sums(size), utilities(numHands), reachProbs(numHands), strategy(size), expected(size);
+		for (float& x : sums) x = distribution(rng);
+		for (float& x : utilities) x = distribution(rng);
+		for (float& x : reachProbs) x = distribution(rng) + 1.0f;
+		// a few hands with no positive regret take the uniform branch
+		for (int hand = 0; hand < numHands; hand += 7)
+			for (int action = 0; action < numActions; action++)
+				sums[action * numHands + hand] = -std::abs(sums[action * numHands + hand]);
+
+		const DcfrDiscount& discount = DcfrDiscount::get(100);
+		RegretKernels::set_instruction_set(InstructionSet::SCALAR);
+		RegretKernels::regret_matching(sums.data(), expected.data(), numHands, numActions);
+
+		for (InstructionSet instructionSet : instructionSets)
+		{
+			if (!RegretKernels::is_supported(instructionSet))
+				continue;
+			RegretKernels::set_instruction_set(instructionSet);
+
+			RegretKernels::regret_matching(sums.data(), strategy.data(), numHands, numActions);
+			float maxError = 0;
+			for (int i = 0; i < size; i++)
+				maxError = std::max(maxError, std::abs(strategy[i] - expected[i]));
+
+			// regrets and strategy sums are updated in place, regrets stay
+			// finite through the discount and strategy sums grow linearly
+			vector<float> regretSum = sums;
+			vector<float> strategySum(size, 0.0f);
+			double nanoseconds[3];
+
+			auto before = chronoClock::now();
+			for (int i = 0; i < repetitions; i++)
+				RegretKernels::regret_matching(regretSum.data(), strategy.data(), numHands, numActions);
+			nanoseconds[0] = sec(chronoClock::now() - before).count() * 1e9;
+
+			before = chronoClock::now();
+			for (int i = 0; i < repetitions; i++)
+				RegretKernels::update_regrets(regretSum.data(), utilities.data(), numHands, numActions, discount);
+			nanoseconds[1] = sec(chronoClock::now() - before).count() * 1e9;
+
+			before = chronoClock::now();
+			for (int i = 0; i < repetitions; i++)
+				RegretKernels::update_strategy_sum(strategySum.data(), strategy.data(), reachProbs.data(), numHands, numActions, discount);
+			nanoseconds[2] = sec(chronoClock::now() - before).count() * 1e9;
+
+			cout << numActions << " actions, " << RegretKernels::get_name(instructionSet) << ": "
+				<< "regret matching " << nanoseconds[0] / repetitions / size << " ns, "
+				<< "regret update " << nanoseconds[1] / repetitions / size << " ns, "
+				<< "strategy sum update " << nanoseconds[2] / repetitions / size << " ns per entry, "
+				<< "max difference to scalar " << maxError << "\n";
+		}
+	}
+
+	RegretKernels::set_instruction_set(defaultInstructionSet);
+}
+
+// Sweeps hero and villain node updates over more regrets than fit in cache,
+// once as separate kernels the way nodes were updated before the fused
+// kernels and once fused.
+void benchmarkNodeUpdates()
+{
+	const int numHands = 1081;
+	const int numActions = 3;
+	const int numNodes = 8192; // 2 x 100 MB of regret and strategy sums
+	const int sweeps = 5;
+	const int blockSize = numHands * numActions;
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+
+	vector<float> regretSums((size_t)blockSize * numNodes), strategySums((size_t)blockSize * numNodes, 0.0f);
+	for (float& x : regretSums) x = distribution(rng);
+	vector<float> actionUtilities(blockSize), utilities(numHands), reachProbs(numHands), strategy(blockSize), actionReachProbs(blockSize);
+	for (float& x : actionUtilities) x = distribution(rng) * 0.01f;
+	for (float& x : reachProbs) x = distribution(rng) + 1.0f;
+	const DcfrDiscount& discount = DcfrDiscount::get(100);
+
+	auto before = chronoClock::now();
+	for (int sweep = 0; sweep < sweeps; sweep++)
+		for (int node = 0; node < numNodes; node++)
+		{
+			float* regretSum = &regretSums[(size_t)node * blockSize];
+			RegretKernels::regret_matching(regretSum, strategy.data(), numHands, numActions);
+			std::fill(begin(utilities), end(utilities), 0.0f);
+			for (int action = 0; action < numActions; action++)
+				for (int hand = 0; hand < numHands; hand++)
+				{
+					regretSum[action * numHands + hand] += actionUtilities[action * numHands + hand];
+					utilities[hand] += strategy[action * numHands + hand] * actionUtilities[action * numHands + hand];
+				}
+			RegretKernels::update_regrets(regretSum, utilities.data(), numHands, numActions, discount);
+		}
+	double separateHero = sec(chronoClock::now() - before).count();
+
+	before = chronoClock::now();
+	for (int sweep = 0; sweep < sweeps; sweep++)
+		for (int node = 0; node < numNodes; node++)
+			RegretKernels::update_hero_node(&regretSums[(size_t)node * blockSize], actionUtilities.data(), utilities.data(), numHands, numActions, discount);
+	double fusedHero = sec(chronoClock::now() - before).count();
+
+	before = chronoClock::now();
+	for (int sweep = 0; sweep < sweeps; sweep++)
+		for (int node = 0; node < numNodes; node++)
+		{
+			RegretKernels::regret_matching(&regretSums[(size_t)node * blockSize], strategy.data(), numHands, numActions);
+			for (int action = 0; action < numActions; action++)
+				for (int hand = 0; hand < numHands; hand++)
+					actionReachProbs[action * numHands + hand] = strategy[action * numHands + hand] * reachProbs[hand];
+			RegretKernels::update_strategy_sum(&strategySums[(size_t)node * blockSize], strategy.data(), reachProbs.data(), numHands, numActions, discount);
+		}
+	double separateVillain = sec(chronoClock::now() - before).count();
+
+	before = chronoClock::now();
+	for (int sweep = 0; sweep < sweeps; sweep++)
+		for (int node = 0; node < numNodes; node++)
+			RegretKernels::update_villain_node(&regretSums[(size_t)node * blockSize], &strategySums[(size_t)node * blockSize],
+				reachProbs.data(), actionReachProbs.data(), numHands, numActions, discount);
+	double fusedVillain = sec(chronoClock::now() - before).count();
+
+	cout << "hero nodes: " << separateHero * 1000 / sweeps << " ms separate, " << fusedHero * 1000 / sweeps << " ms fused per sweep\n";
+	cout << "villain nodes: " << separateVillain * 1000 / sweeps << " ms separate, " << fusedVillain * 1000 / sweeps << " ms fused per sweep\n";
+}
+
+// Trains the testTurn spot once per storage type. The build prints the
+// storage size and the trainer the exploitability against time.
+void benchmarkStorageTypes()
+{
+	string p1StartingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+	string p2StartingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+
+	int inPositionPlayerId = 2;
+
+	Street initialStreet = Street::TURN;
+	uint8_t initialBoard[5] = { card_from_string("Kd"), card_from_string("Jd"), card_from_string("Td"), card_from_string("5s"), 52 };
+
+	int initialPotSize = 100;
+	int startingStackSize = 1000;
+
+	int minimumBetSize = 10;
+	float allinThreshold = 0.67f;
+
+	shared_ptr<RangeManager> rangeManager = make_shared<RangeManager>(p1StartingHands, p2StartingHands, initialBoard);
+
+	StorageType storageTypes[] = { StorageType::FLOAT32, StorageType::FLOAT16, StorageType::BFLOAT16, StorageType::INT16 };
+	const char* storageTypeNames[] = { "fp32", "fp16", "bf16", "int16" };
+
+	for (int i = 0; i < 4; i++)
+	{
+		unique_ptr<BetSettings> p1BetSettings = make_unique<BetSettings>();
+		unique_ptr<BetSettings> p2BetSettings = make_unique<BetSettings>();
+
+		for (BetSettings* betSettings : { p1BetSettings.get(), p2BetSettings.get() })
+		{
+			betSettings->turnBetSizes = { 0.5f, 1.0f };
+			betSettings->riverBetSizes = { 0.25f, 0.5f, 1.0f };
+			betSettings->turnRaiseSizes = { 0.5f };
+			betSettings->riverRaiseSizes = { 0.5f };
+		}
+
+		unique_ptr<TreeBuildSettings> treeBuildSettings = make_unique<TreeBuildSettings>(
+			rangeManager,
+			inPositionPlayerId,
+			initialStreet,
+			initialBoard,
+			initialPotSize,
+			startingStackSize,
+			move(p1BetSettings),
+			move(p2BetSettings),
+			minimumBetSize,
+			allinThreshold);
+		treeBuildSettings->storageType = storageTypes[i];
+
+		cout << "Storage type " << storageTypeNames[i] << "\n";
+		unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
+		gameTree->build();
+
+		unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, initialPotSize, inPositionPlayerId);
+		trainer->train(gameTree.get(), 100);
+	}
+}
+
+// The testTurn spot the simultaneous update test and benchmark run on.
+unique_ptr<GameTree> buildSimultaneousUpdatesTree(shared_ptr<RangeManager> rangeManager, uint8_t initialBoard[5])
+{
+	unique_ptr<BetSettings> p1BetSettings = make_unique<BetSettings>();
+	unique_ptr<BetSettings> p2BetSettings = make_unique<BetSettings>();
+
+	for (BetSettings* betSettings : { p1BetSettings.get(), p2BetSettings.get() })
+	{
+		betSettings->turnBetSizes = { 0.5f, 1.0f };
+		betSettings->riverBetSizes = { 0.25f, 0.5f, 1.0f };
+		betSettings->turnRaiseSizes = { 0.5f };
+		betSettings->riverRaiseSizes = { 0.5f };
+	}
+
+	unique_ptr<TreeBuildSettings> treeBuildSettings = make_unique<TreeBuildSettings>(
+		rangeManager,
+		2,
+		Street::TURN,
+		initialBoard,
+		100,
+		1000,
+		move(p1BetSettings),
+		move(p2BetSettings),
+		10,
+		0.67f);
+
+	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
+	gameTree->build();
+	return gameTree;
+}
+
+// Checks simultaneous updates against alternating ones and throws when they
+// disagree. On a fresh tree both players see the initial strategies in the
+// first iteration, so one simultaneous pass must give each player the root
+// utilities of an alternating pass for that player. Then both modes train
+// and must get below the same exploitability bound.
+void testSimultaneousUpdates()
+{
+	string startingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+	uint8_t initialBoard[5] = { card_from_string("Kd"), card_from_string("Jd"), card_from_string("Td"), card_from_string("5s"), 52 };
+	const int boardIndex = RangeManager::get_board_index(initialBoard);
+
+	shared_ptr<RangeManager> rangeManager = make_shared<RangeManager>(startingHands, startingHands, initialBoard);
+	unique_ptr<GameTree> gameTree = buildSimultaneousUpdatesTree(rangeManager, initialBoard);
+
+	vector<float> reachProbs[2] = { rangeManager->get_initial_reach_probs(1), rangeManager->get_initial_reach_probs(2) };
+	vector<float> alternatingResults[2];
+	vector<float> simultaneousResults[2];
+	for (int player = 1; player <= 2; player++)
+	{
+		alternatingResults[player - 1].resize(rangeManager->get_num_hands(player, boardIndex));
+		simultaneousResults[player - 1].resize(rangeManager->get_num_hands(player, boardIndex));
+	}
+
+	// each pass starts from a fresh tree
+	for (int hero = 1; hero <= 2; hero++)
+	{
+		std::fill(gameTree->storage.begin(), gameTree->storage.end(), 0);
+		CfrTask task(rangeManager, alternatingResults[hero - 1].data(), gameTree.get(), gameTree->root, hero, hero ^ 1 ^ 2,
+			reachProbs[(hero ^ 1 ^ 2) - 1].data(), initialBoard, boardIndex, 1);
+		task.run();
+	}
+
+	std::fill(gameTree->storage.begin(), gameTree->storage.end(), 0);
+	float* const results[2] = { simultaneousResults[0].data(), simultaneousResults[1].data() };
+	const float* const rootReachProbs[2] = { reachProbs[0].data(), reachProbs[1].data() };
+	SimultaneousCfrTask task(rangeManager, results, gameTree.get(), gameTree->root, rootReachProbs, initialBoard, boardIndex, 1);
+	task.run();
+
+	for (int player = 1; player <= 2; player++)
+	{
+		// the passes sum the same terms, the tolerance only leaves room for
+		// a different summation order
+		float maxUtility = 0;
+		float maxDifference = 0;
+		for (size_t i = 0; i < alternatingResults[player - 1].size(); i++)
+		{
+			maxUtility = std::max(maxUtility, std::abs(alternatingResults[player - 1][i]));
+			maxDifference = std::max(maxDifference, std::abs(alternatingResults[player - 1][i] - simultaneousResults[player - 1][i]));
+		}
+		cout << "Player " << player << " root utilities, max difference to alternating " << maxDifference << "\n";
+		if (maxDifference > 1e-5f * maxUtility)
+			throw std::runtime_error("Simultaneous root utilities of player " + std::to_string(player) + " differ from the alternating ones");
+	}
+
+	const int iterations = 300;
+	const float exploitabilityBound = 2.0f;
+	for (bool simultaneousUpdates : { false, true })
+	{
+		cout << (simultaneousUpdates ? "Simultaneous" : "Alternating") << " updates\n";
+		std::fill(gameTree->storage.begin(), gameTree->storage.end(), 0);
+		unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, 100, 2);
+		trainer->settings.simultaneousUpdates = simultaneousUpdates;
+		TrainingResult result = trainer->train(gameTree.get(), iterations);
+		if (result.exploitability > exploitabilityBound)
+			throw std::runtime_error(string(simultaneousUpdates ? "Simultaneous" : "Alternating")
+				+ " updates are still " + std::to_string(result.exploitability) + "% exploitable after "
+				+ std::to_string(iterations) + " iterations");
+	}
+}
+
+// Time per iteration of the testTurn spot with alternating and with
+// simultaneous updates. testSimultaneousUpdates prints how exploitability
+// falls with the iterations of either mode.
+void benchmarkSimultaneousUpdates()
+{
+	string startingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+	uint8_t initialBoard[5] = { card_from_string("Kd"), card_from_string("Jd"), card_from_string("Td"), card_from_string("5s"), 52 };
+
+	shared_ptr<RangeManager> rangeManager = make_shared<RangeManager>(startingHands, startingHands, initialBoard);
+	unique_ptr<GameTree> gameTree = buildSimultaneousUpdatesTree(rangeManager, initialBoard);
+
+	for (bool simultaneousUpdates : { false, true })
+	{
+		std::fill(gameTree->storage.begin(), gameTree->storage.end(), 0);
+		unique_ptr<Trainer> trainer = make_unique<Trainer>(rangeManager, initialBoard, 100, 2);
+		trainer->settings.simultaneousUpdates = simultaneousUpdates;
+		cout << (simultaneousUpdates ? "Simultaneous" : "Alternating") << " updates: "
+			<< trainer->time_iterations(gameTree.get(), 100) * 1000 << " ms per iteration\n";
+	}
+}
+
+// Builds the testTurn spot and the testFlop betting on narrow ranges a few
+// times each and prints the average build time and the action nodes built
+// per second. Storage is allocated and zeroed as part of every build.
+void benchmarkTreeBuild()
+{
+	string turnHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+	string flopHands = "AA,KK,QQ,JJ,AK,AQ,KQ";
+
+	uint8_t turnBoard[5] = { card_from_string("Kd"), card_from_string("Jd"), card_from_string("Td"), card_from_string("5s"), 52 };
+	uint8_t flopBoard[5] = { card_from_string("Kd"), card_from_string("Jc"), card_from_string("Ts"), 52, 52 };
+
+	for (bool flop : { false, true })
+	{
+		uint8_t* initialBoard = flop ? flopBoard : turnBoard;
+		string& startingHands = flop ? flopHands : turnHands;
+		shared_ptr<RangeManager> rangeManager = make_shared<RangeManager>(startingHands, startingHands, initialBoard);
+
+		const int builds = flop ? 3 : 10;
+		double seconds = 0;
+		size_t actionNodeCount = 0;
+
+		for (int i = 0; i < builds; i++)
+		{
+			unique_ptr<BetSettings> p1BetSettings = make_unique<BetSettings>();
+			unique_ptr<BetSettings> p2BetSettings = make_unique<BetSettings>();
+
+			for (BetSettings* betSettings : { p1BetSettings.get(), p2BetSettings.get() })
+			{
+				betSettings->flopBetSizes = { 0.5f, 1.0f };
+				betSettings->flopRaiseSizes = { 0.5f };
+				betSettings->turnBetSizes = flop ? vector<float>{ 1.0f } : vector<float>{ 0.5f, 1.0f };
+				betSettings->turnRaiseSizes = { 0.5f };
+				betSettings->riverBetSizes = flop ? vector<float>{ 1.0f } : vector<float>{ 0.25f, 0.5f, 1.0f };
+				betSettings->riverRaiseSizes = { 0.5f };
+			}
+
+			unique_ptr<TreeBuildSettings> treeBuildSettings = make_unique<TreeBuildSettings>(
+				rangeManager,
+				2,
+				flop ? Street::FLOP : Street::TURN,
+				initialBoard,
+				flop ? 55 : 100,
+				flop ? 975 : 1000,
+				move(p1BetSettings),
+				move(p2BetSettings),
+				10,
+				0.67f);
+
+			unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
+			const auto start = chronoClock::now();
+			gameTree->build();
+			seconds += sec(chronoClock::now() - start).count();
+			actionNodeCount = gameTree->actionNodes.size();
+		}
+
+		cout << (flop ? "Flop" : "Turn") << " tree: " << seconds * 1000 / builds << " ms per build, "
+			<< actionNodeCount * builds / seconds << " action nodes per second\n";
+	}
+}
+
+// Times the RangeManager constructor and the first tree build of a flop spot
+// with full ranges, which builds the ranges of the turn cards it deals, then
+// the ranges of the turn cards suit isomorphism left out.
+void benchmarkRangeInitialization()
+{
+	string startingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+
+	for (const char* flop : { "KdJcTs", "KdJdTd" })
+	{
+		uint8_t initialBoard[5] = { card_from_string(string(flop, 2)), card_from_string(string(flop + 2, 2)),
+			card_from_string(string(flop + 4, 2)), 52, 52 };
+
+		const auto start = chronoClock::now();
+		shared_ptr<RangeManager> rangeManager = make_shared<RangeManager>(startingHands, startingHands, initialBoard);
+		const auto constructed = chronoClock::now();
+
+		unique_ptr<BetSettings> p1BetSettings = make_unique<BetSettings>();
+		unique_ptr<BetSettings> p2BetSettings = make_unique<BetSettings>();
+		for (BetSettings* betSettings : { p1BetSettings.get(), p2BetSettings.get() })
+		{
+			betSettings->flopBetSizes = { 1.0f };
+			betSettings->turnBetSizes = { 1.0f };
+			betSettings->riverBetSizes = { 1.0f };
+		}
+
+		unique_ptr<TreeBuildSettings> treeBuildSettings = make_unique<TreeBuildSettings>(
+			rangeManager,
+			2,
+			Street::FLOP,
+			initialBoard,
+			55,
+			975,
+			move(p1BetSettings),
+			move(p2BetSettings),
+			10,
+			0.67f);
+
+		unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
+		gameTree->build();
+		const auto built = chronoClock::now();
+
+		rangeManager->initialize_all_turns();
+		const auto allTurns = chronoClock::now();
+
+		cout << flop << ": constructor " << sec(constructed - start).count() * 1000 << " ms, first tree "
+			<< sec(built - start).count() * 1000 << " ms, remaining turn cards "
+			<< sec(allTurns - built).count() * 1000 << " ms\n";
+	}
+}
+
+// Estimates the testFlop spot without building it, then the bet sizes to drop
+// for it to fit in 2 GB, and shows build refusing it under that budget.
+void testTreeEstimate()
+{
+	string startingHands = "AA,KK,QQ,JJ,TT,99,88,77,66,55,44,33,22,AK,AQ,AJ,AT,A9,A8,A7,A6,A5,A4,A3,A2,KQ,KJ,KT,K9,K8,K7,K6,K5,K4,K3,K2,QJ,QT,Q9,Q8,Q7,Q6,Q5,Q4,Q3,Q2,JT,J9,J8,J7,J6,J5,J4,J3,J2,T9,T8,T7,T6,T5,T4,T3,T2,98,97,96,95,94,93,92,87,86,85,84,83,82,76,75,74,73,72,65,64,63,62,54,53,52,43,42,32";
+	uint8_t initialBoard[5] = { card_from_string("Kd"), card_from_string("Jc"), card_from_string("Ts"), 52, 52 };
+
+	unique_ptr<BetSettings> p1BetSettings = make_unique<BetSettings>();
+	unique_ptr<BetSettings> p2BetSettings = make_unique<BetSettings>();
+
+	for (BetSettings* betSettings : { p1BetSettings.get(), p2BetSettings.get() })
+	{
+		betSettings->flopBetSizes = { 0.5f, 1.0f };
+		betSettings->flopRaiseSizes = { 0.5f };
+		betSettings->turnBetSizes = { 0.5f, 1.0f };
+		betSettings->turnRaiseSizes = { 0.5f };
+		betSettings->riverBetSizes = { 0.25f, 0.5f, 1.0f };
+		betSettings->riverRaiseSizes = { 0.5f };
+	}
+
+	shared_ptr<RangeManager> rangeManager = make_shared<RangeManager>(startingHands, startingHands, initialBoard);
+
+	unique_ptr<TreeBuildSettings> treeBuildSettings = make_unique<TreeBuildSettings>(
+		rangeManager,
+		2,
+		Street::FLOP,
+		initialBoard,
+		55,
+		975,
+		move(p1BetSettings),
+		move(p2BetSettings),
+		10,
+		0.67f);
+	treeBuildSettings->memoryBudget = (size_t)2 * 1024 * 1024 * 1024;
+
+	unique_ptr<GameTree> gameTree = make_unique<GameTree>(move(treeBuildSettings));
+
+	const auto start = chronoClock::now();
+	TreeEstimate treeEstimate = gameTree->estimate();
+	cout << "Estimated in " << sec(chronoClock::now() - start).count() * 1000 << " ms\n";
+	treeEstimate.print();
+
+	vector<string> drops;
+	bool fits = gameTree->get_bet_size_drops(gameTree->treeBuildSettings->memoryBudget, drops);
+	cout << (fits ? "Fits in 2 GB without:" : "Doesn't fit in 2 GB after dropping:");
+	for (string& drop : drops)
+		cout << " " << drop << ";";
+	cout << "\n";
+
+	try
+	{
+		gameTree->build();
+	}
+	catch (std::runtime_error& error)
+	{
+		cout << error.what() << "\n";
+	}
 }
 
 int main()